@@ -0,0 +1,81 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CBENCH_H
+#define CBENCH_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// microbenchmark harness : every case is warmed up, its iterations count calibrated so that
+// one run lasts at least mintime seconds, then timed over several runs
+// the fastest run is the reported figure (least disturbed), the median shows the spread
+class CBench {
+public:
+	CBench( const char *filter = 0, double mintime = 0.05, unsigned runs = 7) :
+		m_filter( filter),
+		m_mintime( mintime),
+		m_runs( runs ? runs : 1),
+		m_sink( 0) {
+		printf( "%-28s %12s %12s %14s\n", "# case", "ns/op", "median", "ops/s");
+	}
+	// op( ii) performs one operation on input ii (to be taken modulo the inputs count) and
+	// returns a value, all of them summed into a sink so that the work cannot be optimized out
+	template<class Op> void Run( const char *name, Op op) {
+		if (m_filter && !strstr( name, m_filter))
+			return;
+		unsigned long iters = 1;
+		// warm-up and calibration
+		while (Time( op, iters) < m_mintime / 4 && iters < (1ul << 40))
+			iters *= 2;
+		iters *= 4;
+		std::vector<double> ns;
+		for (unsigned ii = 0; ii < m_runs; ii++) {
+			ns.push_back( Time( op, iters) * 1e9 / iters);
+		}
+		std::sort( ns.begin(), ns.end());
+		printf( "%-28s %12.2f %12.2f %14.0f\n", name, ns[0], ns[ns.size() / 2], 1e9 / ns[0]);
+		fflush( stdout);
+	}
+private:
+	template<class Op> double Time( Op& op, unsigned long iters) {
+		double sum = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		for (unsigned long ii = 0; ii < iters; ii++) {
+			sum += op( (unsigned)ii);
+		}
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		m_sink = m_sink + sum;
+		return std::chrono::duration<double>( t1 - t0).count();
+	}
+	const char *m_filter;	// substring of the case names to run (0 => all)
+	double m_mintime;
+	unsigned m_runs;
+	volatile double m_sink;
+};
+
+// cheap deterministic generator for the inputs (same sequence on every platform)
+class CRand {
+public:
+	CRand( unsigned seed = 1) : m_x( seed ? seed : 1) {
+	}
+	// in [0,1[
+	double Next() {
+		m_x ^= m_x << 13;
+		m_x ^= m_x >> 17;
+		m_x ^= m_x << 5;
+		return m_x / 4294967296.0;
+	}
+	double Next( double lo, double hi) {
+		return lo + (hi - lo) * Next();
+	}
+private:
+	unsigned m_x;
+};
+
+#endif/*CBENCH_H*/
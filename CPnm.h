@@ -0,0 +1,99 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CPNM_H
+#define CPNM_H
+
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+// streaming P6 (binary) / P3 (text) image writer : pixels are appended row by row
+// into a large buffer, written out whenever it fills up (and at the end)
+// P3 values are formatted by hand, exactly as printf( "%2.lf") would
+class CPnm {
+public:
+	enum { SIZE = 1 << 20 };	// buffer bytes
+	enum { PIXEL = 3 * 32 + 3 };	// worst case bytes per pixel
+	// colors are scaled by max (the header maximum value)
+	CPnm( FILE *f, int binary, unsigned w, unsigned h, int max) :
+		m_f( f),
+		m_binary( binary),
+		m_max( max),
+		m_buf( SIZE),
+		m_pos( 0) {
+		m_pos += snprintf( &m_buf[0], SIZE, "%s\n%u %u\n%d\n", binary ? "P6" : "P3", w, h, max);
+	}
+	~CPnm() {
+		Flush();
+	}
+	void Pixel( double r, double g, double b) {
+		if (m_pos + PIXEL > m_buf.size())
+			Flush();
+		char *p = &m_buf[m_pos];
+		if (m_binary) {
+			// same conversion as assigning to an unsigned char
+			*p++ = (unsigned char)(m_max * r);
+			*p++ = (unsigned char)(m_max * g);
+			*p++ = (unsigned char)(m_max * b);
+		} else {
+			p = Fmt( p, m_max * r);
+			*p++ = ' ';
+			p = Fmt( p, m_max * g);
+			*p++ = ' ';
+			p = Fmt( p, m_max * b);
+			*p++ = ' ';
+			*p++ = ' ';
+			*p++ = ' ';
+		}
+		m_pos = p - &m_buf[0];
+	}
+	// raw character (P3 only)
+	void Put( char c) {
+		if (m_pos + 1 > m_buf.size())
+			Flush();
+		m_buf[m_pos++] = c;
+	}
+	void EndRow() {
+		if (!m_binary)
+			Put( '\n');
+	}
+	void Flush() {
+		if (m_pos)
+			fwrite( &m_buf[0], 1, m_pos, m_f);
+		m_pos = 0;
+	}
+private:
+	// "%2.lf" : nearest integer (ties to even, as printf in the default rounding mode),
+	// right aligned on 2 characters, sign kept for negative values (even rounded to 0)
+	static char *Fmt( char *p, double x) {
+		if (!(fabs( x) < 1e18)) {
+			// nan, inf or huge : leave it to libc (absurdly long ones get truncated)
+			int n = snprintf( p, 32, "%2.lf", x);
+			return p + (n < 32 ? n : 31);
+		}
+		char tmp[24];
+		unsigned len = 0;
+		unsigned long long n = nearbyint( fabs( x));
+		do {
+			tmp[len++] = '0' + n % 10;
+			n /= 10;
+		} while (n);
+		if (signbit( x))
+			tmp[len++] = '-';
+		if (len < 2)
+			*p++ = ' ';
+		while (len)
+			*p++ = tmp[--len];
+		return p;
+	}
+	FILE *m_f;
+	int m_binary;
+	int m_max;
+	std::vector<char> m_buf;
+	size_t m_pos;
+};
+
+#endif/*CPNM_H*/
@@ -0,0 +1,121 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CPOOL_H
+#define CPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// worker pool splitting a w x h frame into square tiles
+// each tile is handed exactly once to one thread (the caller included)
+class CPool {
+public:
+	typedef std::function<void( unsigned x0, unsigned y0, unsigned x1, unsigned y1)> Job;
+	CPool( unsigned nthreads = 0, unsigned tile = 32) :
+		m_tile( tile ? tile : 32),
+		m_gen( 0),
+		m_quit( 0),
+		m_busy( 0),
+		m_next( 0),
+		m_ntiles( 0),
+		m_tx( 0),
+		m_w( 0),
+		m_h( 0),
+		m_job( 0) {
+		if (!nthreads)
+			nthreads = std::thread::hardware_concurrency();
+		if (!nthreads)
+			nthreads = 1;
+		for (unsigned ii = 1; ii < nthreads; ii++) {
+			m_threads.push_back( std::thread( &CPool::Worker, this));
+		}
+	}
+	~CPool() {
+		{
+			std::lock_guard<std::mutex> lock( m_mutex);
+			m_quit = 1;
+		}
+		m_cv.notify_all();
+		for (unsigned ii = 0; ii < m_threads.size(); ii++) {
+			m_threads.at( ii).join();
+		}
+	}
+	unsigned Threads() const {
+		return m_threads.size() + 1;
+	}
+	unsigned Tile() const {
+		return m_tile;
+	}
+	// calls job on every tile of the w x h frame, returns when all tiles are done
+	void Run( unsigned w, unsigned h, const Job& job) {
+		unsigned tx = (w + m_tile - 1) / m_tile;
+		unsigned ty = (h + m_tile - 1) / m_tile;
+		{
+			std::lock_guard<std::mutex> lock( m_mutex);
+			m_w = w;
+			m_h = h;
+			m_tx = tx;
+			m_ntiles = tx * ty;
+			m_job = &job;
+			m_next = 0;
+			m_busy = m_threads.size();
+			m_gen++;
+		}
+		m_cv.notify_all();
+		Tiles();
+		std::unique_lock<std::mutex> lock( m_mutex);
+		m_done.wait( lock, [this] { return m_busy == 0; });
+		m_job = 0;
+	}
+private:
+	void Tiles() {
+		unsigned t;
+		while ((t = m_next++) < m_ntiles) {
+			unsigned x0 = (t % m_tx) * m_tile;
+			unsigned y0 = (t / m_tx) * m_tile;
+			unsigned x1 = x0 + m_tile;
+			unsigned y1 = y0 + m_tile;
+			if (x1 > m_w)
+				x1 = m_w;
+			if (y1 > m_h)
+				y1 = m_h;
+			(*m_job)( x0, y0, x1, y1);
+		}
+	}
+	void Worker() {
+		unsigned gen = 0;
+		while (1) {
+			{
+				std::unique_lock<std::mutex> lock( m_mutex);
+				m_cv.wait( lock, [this, gen] { return m_quit || m_gen != gen; });
+				if (m_quit)
+					return;
+				gen = m_gen;
+			}
+			Tiles();
+			std::lock_guard<std::mutex> lock( m_mutex);
+			if (--m_busy == 0)
+				m_done.notify_one();
+		}
+	}
+	unsigned m_tile;	// tile edge in pixels
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;	// new frame (or quit) for workers
+	std::condition_variable m_done;	// all workers finished current frame
+	unsigned m_gen;		// frame generation counter
+	int m_quit;
+	unsigned m_busy;	// workers still running current frame
+	std::atomic<unsigned> m_next;	// next tile to hand out
+	unsigned m_ntiles, m_tx;
+	unsigned m_w, m_h;
+	const Job *m_job;
+};
+
+#endif/*CPOOL_H*/
@@ -41,20 +41,20 @@ public:
 	SDL_CreateWindowAndRenderer( m_w, m_h, 0
 //	|| SDL_WINDOW_FULLSCREEN_DESKTOP
 	, &m_sdlWindow, &m_sdlRenderer);
-	m_screen = SDL_CreateRGBSurface( 0, m_w, m_h, m_bpp,
-                                        0x00FF0000,
-                                        0x0000FF00,
-                                        0x000000FF,
-                                        0xFF000000);
+	// frames are packed straight into the locked streaming texture, no intermediate surface
 	m_sdlTexture = SDL_CreateTexture( m_sdlRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, m_w, m_h);
 #endif
+#ifdef SDL1
 	if (!m_screen) {
+#else
+	if (!m_sdlTexture) {
+#endif
 		printf( "failed to init SDL\n");
 		exit( 1);
 	}
 	atexit( SDL_Quit);
 	}
-	enum { NONE, QUIT, LEFT, RIGHT, UP, DOWN, PUP, PDOWN, K_d, K_j};
+	enum { NONE, QUIT, LEFT, RIGHT, UP, DOWN, PUP, PDOWN, K_d, K_j, K_f, K_r, K_l, K_s, K_a};
 	int Poll( int *_ctrl = 0, int *_shift = 0) {
 		int result = NONE;
 		SDL_Event event;
@@ -167,6 +167,26 @@ public:
 					result = K_j;
 					break;
 				}
+				else if (event.key.keysym.sym == SDLK_f) {
+					result = K_f;
+					break;
+				}
+				else if (event.key.keysym.sym == SDLK_r) {
+					result = K_r;
+					break;
+				}
+				else if (event.key.keysym.sym == SDLK_l) {
+					result = K_l;
+					break;
+				}
+				else if (event.key.keysym.sym == SDLK_s) {
+					result = K_s;
+					break;
+				}
+				else if (event.key.keysym.sym == SDLK_a) {
+					result = K_a;
+					break;
+				}
 			}
 		}
 		if (_ctrl)
@@ -178,47 +198,91 @@ public:
 		}
 		return result;
 	}
-	void Draw( double *arr = 0) {
-		SDL_Rect rect;
-		if (arr) {
-			rect.w = 1;
-			rect.h = 1;
-			double *_arr = arr;
+	// converts n RGB doubles (0..1) pixels to ARGB8888; plain loop, vectorized by the compiler
+	static void Pack( Uint32 *dst, const double *src, unsigned n) {
+		for (unsigned ii = 0; ii < n; ii++) {
+			Uint32 r = (int)(src[ii * 3 + 0] * 255) & 0xff;
+			Uint32 g = (int)(src[ii * 3 + 1] * 255) & 0xff;
+			Uint32 b = (int)(src[ii * 3 + 2] * 255) & 0xff;
+			dst[ii] = 0xff000000 | (r << 16) | (g << 8) | b;
+		}
+	}
+	// draws a w x h RGB doubles frame (0 => plain dark red frame)
+	void Draw( const double *arr = 0) {
+#ifdef SDL1
+		if (SDL_LockSurface( m_screen) == 0) {
 			for (unsigned jj = 0; jj < m_h; jj++) {
-				rect.y = jj;
+				Uint32 *line = (Uint32 *)((Uint8 *)m_screen->pixels + jj * m_screen->pitch);
 				for (unsigned ii = 0; ii < m_w; ii++) {
-					rect.x = ii;
-					unsigned r, g, b;
-					r = _arr[0] * 255;
-					g = _arr[1] * 255;
-					b = _arr[2] * 255;
-					Uint32 col = SDL_MapRGB( m_screen->format, r, g, b);
-					SDL_FillRect( m_screen, &rect, col);
-					_arr += 3;
+					unsigned r = 128, g = 0, b = 0;
+					if (arr) {
+						r = arr[0] * 255;
+						g = arr[1] * 255;
+						b = arr[2] * 255;
+						arr += 3;
+					}
+					line[ii] = SDL_MapRGB( m_screen->format, r, g, b);
 				}
 			}
+			SDL_UnlockSurface( m_screen);
 		}
-		else {
-			rect.x = 0;
-			rect.y = 0;
-			rect.w = m_w;
-			rect.h = m_h;
-			Uint32 col = SDL_MapRGB( m_screen->format, 128, 0, 0);
-			SDL_FillRect( m_screen, &rect, col);
+		SDL_UpdateRect( m_screen, 0, 0, 0, 0);
+#else
+		void *pixels;
+		int pitch;
+		if (SDL_LockTexture( m_sdlTexture, NULL, &pixels, &pitch) == 0) {
+			for (unsigned jj = 0; jj < m_h; jj++) {
+				Uint32 *line = (Uint32 *)((Uint8 *)pixels + jj * pitch);
+				if (arr) {
+					Pack( line, arr + jj * m_w * 3, m_w);
+				} else {
+					for (unsigned ii = 0; ii < m_w; ii++) {
+						line[ii] = 0xff800000;
+					}
+				}
+			}
+			SDL_UnlockTexture( m_sdlTexture);
 		}
+		Present();
+#endif
+	}
+	// draws a w x h frame already packed as ARGB8888
+	void DrawPacked( const Uint32 *argb) {
 #ifdef SDL1
+		if (SDL_LockSurface( m_screen) == 0) {
+			for (unsigned jj = 0; jj < m_h; jj++) {
+				Uint32 *line = (Uint32 *)((Uint8 *)m_screen->pixels + jj * m_screen->pitch);
+				for (unsigned ii = 0; ii < m_w; ii++) {
+					Uint32 col = argb[jj * m_w + ii];
+					line[ii] = SDL_MapRGB( m_screen->format, (col >> 16) & 0xff, (col >> 8) & 0xff, col & 0xff);
+				}
+			}
+			SDL_UnlockSurface( m_screen);
+		}
 		SDL_UpdateRect( m_screen, 0, 0, 0, 0);
 #else
-		SDL_UpdateTexture( m_sdlTexture, NULL, m_screen->pixels, m_screen->pitch);
-		SDL_RenderClear( m_sdlRenderer);
-		SDL_RenderCopy( m_sdlRenderer, m_sdlTexture, NULL, NULL);
-		SDL_RenderPresent( m_sdlRenderer);
+		SDL_UpdateTexture( m_sdlTexture, NULL, argb, m_w * sizeof( *argb));
+		Present();
+#endif
+	}
+	void Title( const char *title) {
+#ifdef SDL1
+		SDL_WM_SetCaption( title, 0);
+#else
+		SDL_SetWindowTitle( m_sdlWindow, title);
 #endif
 	}
 	void Delay( unsigned millis) {
 		SDL_Delay( millis);
 	}
 private:
+#ifdef SDL2
+	void Present() {
+		SDL_RenderClear( m_sdlRenderer);
+		SDL_RenderCopy( m_sdlRenderer, m_sdlTexture, NULL, NULL);
+		SDL_RenderPresent( m_sdlRenderer);
+	}
+#endif
 	unsigned int m_w;
 	unsigned int m_h;
 	unsigned int m_bpp;
@@ -0,0 +1,184 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CSCENE_H
+#define CSCENE_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <istream>
+#include <vector>
+
+// binary scene (.realb) : same contents as the .real text files, in native endianness
+//   header : magic "RLSB", version, number of objects, camera (eye, front, up)
+//   then per object : type, len, len doubles (same parameters as the text format)
+// the file is mmap'ed and parameters are read in place (every double is 8-byte aligned)
+// older untyped text scenes (as sph.real) hold spheres only, after the camera : LEGACY numbers
+// each (center, radius, color, then 6 unused ones), read as typed spheres by ReadLegacy()
+class CScene {
+public:
+	enum { VERSION = 1 };
+	enum { SPHERE = 0, SPHERE_LEN = 8 };	// typed sphere : flags, color, center, radius
+	enum { LEGACY = 13 };
+	struct CHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t nobjs;
+		uint32_t reserved;
+		double cam[9];
+	};
+	struct CRecord {
+		uint32_t type;
+		uint32_t len;		// number of doubles following
+	};
+	CScene() : m_map( 0), m_size( 0) {
+	}
+	~CScene() {
+		Close();
+	}
+	// 0 : mapped, 1 : not a binary scene (text ?), -1 : unreadable or corrupted
+	int Open( const char *fname) {
+		Close();
+		int fd = open( fname, O_RDONLY);
+		if (fd < 0)
+			return -1;
+		struct stat st;
+		if (fstat( fd, &st) || (st.st_size < (off_t)sizeof( CHeader))) {
+			close( fd);
+			return 1;
+		}
+		void *map = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close( fd);
+		if (map == MAP_FAILED)
+			return -1;
+		m_map = (const char *)map;
+		m_size = st.st_size;
+		if (memcmp( Header()->magic, "RLSB", 4)) {
+			Close();
+			return 1;
+		}
+		if (Header()->version != VERSION || !Check()) {
+			Close();
+			return -1;
+		}
+		return 0;
+	}
+	void Close() {
+		if (m_map)
+			munmap( (void *)m_map, m_size);
+		m_map = 0;
+		m_size = 0;
+	}
+	const CHeader *Header() const {
+		return (const CHeader *)m_map;
+	}
+	const double *Camera() const {
+		return Header()->cam;
+	}
+	unsigned Objects() const {
+		return Header()->nobjs;
+	}
+	// records walk : for (rec = First(); rec; rec = Next( rec))
+	const CRecord *First() const {
+		return Objects() ? (const CRecord *)(m_map + sizeof( CHeader)) : 0;
+	}
+	const CRecord *Next( const CRecord *rec) const {
+		const char *next = (const char *)Params( rec) + rec->len * sizeof( double);
+		return next < m_map + m_size ? (const CRecord *)next : 0;
+	}
+	static const double *Params( const CRecord *rec) {
+		return (const double *)(rec + 1);
+	}
+	// spheres of an untyped text scene, read from just past its camera, as SPHERE_LEN parameters each
+	// returns the number of spheres, -1 if one is truncated or malformed
+	static int ReadLegacy( std::istream& is, std::vector<double>& params) {
+		params.clear();
+		while (1) {
+			double legacy[LEGACY];
+			unsigned n = 0;
+			while ((n < LEGACY) && (is >> legacy[n]))
+				n++;
+			if (!n && is.eof())
+				break;
+			if (n < LEGACY)
+				return -1;
+			double sph[SPHERE_LEN] = { 0, legacy[4], legacy[5], legacy[6], legacy[0], legacy[1], legacy[2], legacy[3]};
+			params.insert( params.end(), sph, sph + SPHERE_LEN);
+		}
+		return params.size() / SPHERE_LEN;
+	}
+
+	// writer : Begin(), one Add() per object, then End() (patches the objects count)
+	class CWriter {
+	public:
+		CWriter() : m_f( 0), m_nobjs( 0) {
+		}
+		// a writer not End()ed is abandoned : the file is left incomplete, to be removed
+		~CWriter() {
+			Abandon();
+		}
+		int Begin( const char *fname, const double *cam) {
+			m_f = fopen( fname, "wb");
+			if (!m_f)
+				return -1;
+			CHeader hdr;
+			memset( &hdr, 0, sizeof( hdr));
+			memcpy( hdr.magic, "RLSB", 4);
+			hdr.version = VERSION;
+			memcpy( hdr.cam, cam, sizeof( hdr.cam));
+			m_nobjs = 0;
+			return fwrite( &hdr, sizeof( hdr), 1, m_f) == 1 ? 0 : -1;
+		}
+		int Add( unsigned type, unsigned len, const double *params) {
+			CRecord rec = { type, len};
+			if (!m_f || fwrite( &rec, sizeof( rec), 1, m_f) != 1 || fwrite( params, sizeof( double), len, m_f) != len)
+				return -1;
+			m_nobjs++;
+			return 0;
+		}
+		int End() {
+			if (!m_f)
+				return -1;
+			int result = fseek( m_f, offsetof( CHeader, nobjs), SEEK_SET) || fwrite( &m_nobjs, sizeof( m_nobjs), 1, m_f) != 1 ? -1 : 0;
+			if (fclose( m_f))
+				result = -1;
+			m_f = 0;
+			return result;
+		}
+		void Abandon() {
+			if (m_f)
+				fclose( m_f);
+			m_f = 0;
+		}
+	private:
+		FILE *m_f;
+		uint32_t m_nobjs;
+	};
+private:
+	// every record must lie within the file, and there must be exactly nobjs of them
+	int Check() const {
+		const char *p = m_map + sizeof( CHeader);
+		const char *end = m_map + m_size;
+		for (unsigned ii = 0; ii < Objects(); ii++) {
+			if ((size_t)(end - p) < sizeof( CRecord))
+				return 0;
+			const CRecord *rec = (const CRecord *)p;
+			if (rec->len > (size_t)(end - p - sizeof( CRecord)) / sizeof( double))
+				return 0;
+			p += sizeof( CRecord) + rec->len * sizeof( double);
+		}
+		return p == end;
+	}
+	const char *m_map;
+	size_t m_size;
+};
+
+#endif/*CSCENE_H*/
@@ -0,0 +1,641 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CSPHERES_H
+#define CSPHERES_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "CStats.h"
+
+#if defined __AVX__ || defined __SSE2__
+#include <immintrin.h>
+#endif
+
+// lane wrappers, so that one kernel serves every instruction set and scalar type
+template<class T> struct CLanes1 {
+	typedef T V;
+	enum { N = 1 };
+	static V Set( T d) { return d; }
+	static V Load( const T *p) { return *p; }
+	static V Add( V a, V b) { return a + b; }
+	static V Sub( V a, V b) { return a - b; }
+	static V Mul( V a, V b) { return a * b; }
+	static V Div( V a, V b) { return a / b; }
+	static V Neg( V a) { return -a; }
+	static V Sqrt( V a) { return sqrt( a); }
+	static V Min( V a, V b) { return a < b ? a : b; }
+	static int Gt( V a, V b) { return a > b; }
+	static int Lt( V a, V b) { return a < b; }
+	static int Eq( V a, V b) { return a == b; }
+	static int And( int a, int b) { return a && b; }
+	static int Or( int a, int b) { return a || b; }
+	static V Select( int m, V a, V b) { return m ? a : b; }
+	static int Mask( int m) { return m; }
+	static void Store( T *p, V a) { *p = a; }
+};
+#if defined __SSE2__
+struct CLanes2 {
+	typedef __m128d V;
+	enum { N = 2 };
+	static V Set( double d) { return _mm_set1_pd( d); }
+	static V Load( const double *p) { return _mm_load_pd( p); }
+	static V Add( V a, V b) { return _mm_add_pd( a, b); }
+	static V Sub( V a, V b) { return _mm_sub_pd( a, b); }
+	static V Mul( V a, V b) { return _mm_mul_pd( a, b); }
+	static V Div( V a, V b) { return _mm_div_pd( a, b); }
+	static V Neg( V a) { return _mm_xor_pd( a, _mm_set1_pd( -0.0)); }
+	static V Sqrt( V a) { return _mm_sqrt_pd( a); }
+	static V Min( V a, V b) { return _mm_min_pd( a, b); }
+	static V Gt( V a, V b) { return _mm_cmpgt_pd( a, b); }
+	static V Lt( V a, V b) { return _mm_cmplt_pd( a, b); }
+	static V Eq( V a, V b) { return _mm_cmpeq_pd( a, b); }
+	static V And( V a, V b) { return _mm_and_pd( a, b); }
+	static V Or( V a, V b) { return _mm_or_pd( a, b); }
+	static V Select( V m, V a, V b) { return _mm_or_pd( _mm_and_pd( m, a), _mm_andnot_pd( m, b)); }
+	static int Mask( V m) { return _mm_movemask_pd( m); }
+	static void Store( double *p, V a) { _mm_store_pd( p, a); }
+};
+struct CLanes4f {
+	typedef __m128 V;
+	enum { N = 4 };
+	static V Set( float d) { return _mm_set1_ps( d); }
+	static V Load( const float *p) { return _mm_load_ps( p); }
+	static V Add( V a, V b) { return _mm_add_ps( a, b); }
+	static V Sub( V a, V b) { return _mm_sub_ps( a, b); }
+	static V Mul( V a, V b) { return _mm_mul_ps( a, b); }
+	static V Div( V a, V b) { return _mm_div_ps( a, b); }
+	static V Neg( V a) { return _mm_xor_ps( a, _mm_set1_ps( -0.0f)); }
+	static V Sqrt( V a) { return _mm_sqrt_ps( a); }
+	static V Min( V a, V b) { return _mm_min_ps( a, b); }
+	static V Gt( V a, V b) { return _mm_cmpgt_ps( a, b); }
+	static V Lt( V a, V b) { return _mm_cmplt_ps( a, b); }
+	static V Eq( V a, V b) { return _mm_cmpeq_ps( a, b); }
+	static V And( V a, V b) { return _mm_and_ps( a, b); }
+	static V Or( V a, V b) { return _mm_or_ps( a, b); }
+	static V Select( V m, V a, V b) { return _mm_or_ps( _mm_and_ps( m, a), _mm_andnot_ps( m, b)); }
+	static int Mask( V m) { return _mm_movemask_ps( m); }
+	static void Store( float *p, V a) { _mm_store_ps( p, a); }
+};
+#endif
+#if defined __AVX__
+struct CLanes4 {
+	typedef __m256d V;
+	enum { N = 4 };
+	static V Set( double d) { return _mm256_set1_pd( d); }
+	static V Load( const double *p) { return _mm256_load_pd( p); }
+	static V Add( V a, V b) { return _mm256_add_pd( a, b); }
+	static V Sub( V a, V b) { return _mm256_sub_pd( a, b); }
+	static V Mul( V a, V b) { return _mm256_mul_pd( a, b); }
+	static V Div( V a, V b) { return _mm256_div_pd( a, b); }
+	static V Neg( V a) { return _mm256_xor_pd( a, _mm256_set1_pd( -0.0)); }
+	static V Sqrt( V a) { return _mm256_sqrt_pd( a); }
+	static V Min( V a, V b) { return _mm256_min_pd( a, b); }
+	static V Gt( V a, V b) { return _mm256_cmp_pd( a, b, _CMP_GT_OQ); }
+	static V Lt( V a, V b) { return _mm256_cmp_pd( a, b, _CMP_LT_OQ); }
+	static V Eq( V a, V b) { return _mm256_cmp_pd( a, b, _CMP_EQ_OQ); }
+	static V And( V a, V b) { return _mm256_and_pd( a, b); }
+	static V Or( V a, V b) { return _mm256_or_pd( a, b); }
+	static V Select( V m, V a, V b) { return _mm256_blendv_pd( b, a, m); }
+	static int Mask( V m) { return _mm256_movemask_pd( m); }
+	static void Store( double *p, V a) { _mm256_store_pd( p, a); }
+};
+struct CLanes8f {
+	typedef __m256 V;
+	enum { N = 8 };
+	static V Set( float d) { return _mm256_set1_ps( d); }
+	static V Load( const float *p) { return _mm256_load_ps( p); }
+	static V Add( V a, V b) { return _mm256_add_ps( a, b); }
+	static V Sub( V a, V b) { return _mm256_sub_ps( a, b); }
+	static V Mul( V a, V b) { return _mm256_mul_ps( a, b); }
+	static V Div( V a, V b) { return _mm256_div_ps( a, b); }
+	static V Neg( V a) { return _mm256_xor_ps( a, _mm256_set1_ps( -0.0f)); }
+	static V Sqrt( V a) { return _mm256_sqrt_ps( a); }
+	static V Min( V a, V b) { return _mm256_min_ps( a, b); }
+	static V Gt( V a, V b) { return _mm256_cmp_ps( a, b, _CMP_GT_OQ); }
+	static V Lt( V a, V b) { return _mm256_cmp_ps( a, b, _CMP_LT_OQ); }
+	static V Eq( V a, V b) { return _mm256_cmp_ps( a, b, _CMP_EQ_OQ); }
+	static V And( V a, V b) { return _mm256_and_ps( a, b); }
+	static V Or( V a, V b) { return _mm256_or_ps( a, b); }
+	static V Select( V m, V a, V b) { return _mm256_blendv_ps( b, a, m); }
+	static int Mask( V m) { return _mm256_movemask_ps( m); }
+	static void Store( float *p, V a) { _mm256_store_ps( p, a); }
+};
+#endif
+// widest lanes of the instruction set for scalar T
+template<class T> struct CLanesOf {
+	typedef CLanes1<T> L;
+};
+#if defined __AVX__
+template<> struct CLanesOf<double> {
+	typedef CLanes4 L;
+};
+template<> struct CLanesOf<float> {
+	typedef CLanes8f L;
+};
+#elif defined __SSE2__
+template<> struct CLanesOf<double> {
+	typedef CLanes2 L;
+};
+template<> struct CLanesOf<float> {
+	typedef CLanes4f L;
+};
+#endif
+
+// constants of the sphere stores, whatever their scalar type
+class CSpheres {
+public:
+	enum { NONE = ~0u };
+	enum { CX, CY, CZ, R2, RED, GREEN, BLUE, HOLLOW, IDX, FIELDS };
+	enum { STACK = 64 };	// traversal stack (the tree is balanced)
+};
+
+// structure of arrays sphere store of scalar T (double or float) : one ray is tested against
+// several spheres per instruction (twice as many in float)
+// results are bit-identical to CSphere::Intersec in the same scalar (same operations, same order)
+// once filled, Build() sorts the spheres into the leaves of a bounding volume hierarchy,
+// so that a ray only visits O(log n) of them
+// object indices and slots are stored as T : exact below 2^24 spheres in float
+template<class T = double> class CSpheresT : public CSpheres {
+	typedef typename CLanesOf<T>::L CLanes;
+public:
+	enum { LANES = CLanes::N };
+	enum { LEAF = 2 * LANES < 4 ? 4 : 2 * LANES };	// max spheres per leaf
+	enum { ALIGN = 32 / sizeof( T) };	// scalars per 32 bytes
+	CSpheresT() : m_n( 0), m_cap( 0), m_p( 0), m_eps( 0) {
+	}
+	void Clear() {
+		m_n = 0;
+		m_nodes.clear();
+	}
+	// idx is the caller object index, reported back by Closest
+	// spheres are added after Clear() then made visible to the queries by Build()
+	void Add( const T *c, T r, const T *col, int hollow, unsigned idx) {
+		if (m_n == m_cap)
+			Grow();
+		m_p[CX * m_cap + m_n] = c[0];
+		m_p[CY * m_cap + m_n] = c[1];
+		m_p[CZ * m_cap + m_n] = c[2];
+		m_p[R2 * m_cap + m_n] = r * r;
+		m_p[RED * m_cap + m_n] = col[0];
+		m_p[GREEN * m_cap + m_n] = col[1];
+		m_p[BLUE * m_cap + m_n] = col[2];
+		m_p[HOLLOW * m_cap + m_n] = hollow ? 1 : 0;
+		m_p[IDX * m_cap + m_n] = idx;
+		m_n++;
+		Pad();
+	}
+	// builds the hierarchy over the spheres added since Clear() : the store is then reordered
+	// leaf by leaf, each leaf starting on a LANES boundary (gaps hold void spheres)
+	void Build() {
+		m_nodes.clear();
+		if (!m_n)
+			return;
+		// boxes are inflated so as to stay conservative against the rounding of the intersections
+		T ext = 0;
+		for (unsigned k = 0; k < m_n; k++) {
+			T r = sqrt( m_p[R2 * m_cap + k]);
+			for (unsigned ii = 0; ii < 3; ii++) {
+				T d = fabs( m_p[(CX + ii) * m_cap + k]) + r;
+				if (d > ext)
+					ext = d;
+			}
+		}
+		m_eps = (sizeof( T) < sizeof( double) ? 1e-4 : 1e-6) * (1 + ext);
+		std::vector<unsigned> order( m_n);
+		for (unsigned k = 0; k < m_n; k++)
+			order[k] = k;
+		unsigned slots = 0;
+		Split( order, 0, m_n, slots);
+		std::vector<T> buf( FIELDS * slots + ALIGN);
+		T *p = Align( &buf[0]);
+		for (unsigned k = 0; k < slots; k++)
+			Void( p, slots, k);
+		// leaves were created depth first, left to right : they walk order[] in sequence
+		unsigned b = 0;
+		for (unsigned ii = 0; ii < m_nodes.size(); ii++) {
+			const CNode& nd = m_nodes[ii];
+			for (unsigned k = 0; k < nd.n; k++, b++) {
+				for (unsigned f = 0; f < FIELDS; f++) {
+					p[f * slots + nd.first + k] = m_p[f * m_cap + order[b]];
+				}
+			}
+		}
+		m_buf.swap( buf);
+		m_p = p;
+		m_cap = slots;
+	}
+	unsigned Size() const {
+		return m_n;
+	}
+	unsigned Index( unsigned k) const {
+		return m_p[IDX * m_cap + k];
+	}
+	void Color( unsigned k, T *col) const {
+		col[0] = m_p[RED * m_cap + k];
+		col[1] = m_p[GREEN * m_cap + k];
+		col[2] = m_p[BLUE * m_cap + k];
+	}
+	// nearest sphere hit (t > 0) along o + t * v, if closer than tmin (ties go to the lowest index)
+	// updates tmin/imin and returns the store slot of the hit sphere (NONE if none closer)
+	unsigned Closest( const T *o, const T *v, T& tmin, unsigned& imin) const {
+		unsigned kmin = NONE;
+		T tbest = HUGE_VAL;
+		if (m_nodes.empty())
+			return NONE;
+		kmin = ClosestK<CLanes>( o, v, tmin, tbest);
+		if (kmin == NONE)
+			return NONE;
+		if ((tbest < tmin) || ((tbest == tmin) && (Index( kmin) < imin))) {
+			tmin = tbest;
+			imin = Index( kmin);
+			return kmin;
+		}
+		return NONE;
+	}
+	// packet version of Closest for n rays sharing origin o (v holds n x 3 Ts) : rays go in the
+	// lanes, and o - center is computed once per sphere for the whole packet
+	// t/idx/k must be initialized (HUGE_VAL/NONE) and are updated as by n calls to Closest
+	void ClosestPacket( const T *o, const T *v, unsigned n, T *t, unsigned *idx, unsigned *k) const {
+		if (m_nodes.empty())
+			return;
+		for (unsigned ii = 0; ii < n; ii += LANES) {
+			unsigned nn = n - ii < (unsigned)LANES ? n - ii : (unsigned)LANES;
+			T tbest[LANES];
+			unsigned kbest[LANES];
+			ClosestRaysK<CLanes>( o, v + ii * 3, nn, tbest, kbest);
+			for (unsigned jj = 0; jj < nn; jj++) {
+				unsigned kk = kbest[jj];
+				if (kk == NONE)
+					continue;
+				if ((tbest[jj] < t[ii + jj]) || ((tbest[jj] == t[ii + jj]) && (Index( kk) < idx[ii + jj]))) {
+					t[ii + jj] = tbest[jj];
+					idx[ii + jj] = Index( kk);
+					k[ii + jj] = kk;
+				}
+			}
+		}
+	}
+	// is any non hollow sphere (but object skip) hit along o + t * v (v unit) with 0 < t < dmax ?
+	// stops at the first one found
+	int Occluded( const T *o, const T *v, T dmax, unsigned skip) const {
+		if (m_nodes.empty())
+			return 0;
+		return OccludedK<CLanes>( o, v, dmax, skip);
+	}
+private:
+	// hierarchy node; the left child of an inner node immediately follows it
+	struct CNode {
+		T lo[3], hi[3];	// bounds of the spheres below
+		unsigned n;		// leaf : number of spheres, 0 for an inner node
+		unsigned first, end;	// leaf : slots [first,end[ (end - first multiple of LANES)
+		unsigned right;		// inner node : right child
+		unsigned axis;		// inner node : split axis
+		int solid;		// some sphere below is not hollow
+	};
+	// same steps as CSphere::Intersec + solvetri, LANES spheres at a time
+	template<class L> typename L::V Intersec( unsigned k, const typename L::V *o, const typename L::V *v, typename L::V a) const {
+		typedef typename L::V V;
+		V zero = L::Set( 0);
+		V tx = L::Sub( o[0], L::Load( &m_p[CX * m_cap + k]));
+		V ty = L::Sub( o[1], L::Load( &m_p[CY * m_cap + k]));
+		V tz = L::Sub( o[2], L::Load( &m_p[CZ * m_cap + k]));
+		V vt = L::Add( L::Add( L::Add( zero, L::Mul( v[0], tx)), L::Mul( v[1], ty)), L::Mul( v[2], tz));
+		V tt = L::Add( L::Add( L::Add( zero, L::Mul( tx, tx)), L::Mul( ty, ty)), L::Mul( tz, tz));
+		V b = L::Mul( L::Set( 2), vt);
+		V c = L::Sub( tt, L::Load( &m_p[R2 * m_cap + k]));
+		V d = L::Sub( L::Mul( b, b), L::Mul( L::Mul( L::Set( 4), a), c));
+		V two = L::Set( 2);
+		V nb = L::Neg( b);
+		V sd = L::Sqrt( L::Select( L::Gt( d, zero), d, zero));
+		V t1 = L::Div( L::Div( L::Sub( nb, sd), two), a);
+		V t2 = L::Div( L::Div( L::Add( nb, sd), two), a);
+		V t0 = L::Div( L::Div( nb, two), a);
+		return L::Select( L::Gt( d, zero), L::Min( t1, t2), L::Select( L::Eq( d, zero), t0, L::Set( HUGE_VAL)));
+	}
+	template<class L> void Setup( const T *o, const T *v, typename L::V *vo, typename L::V *vv, typename L::V& va) const {
+		T a = 0;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			vo[ii] = L::Set( o[ii]);
+			vv[ii] = L::Set( v[ii]);
+			a += v[ii] * v[ii];
+		}
+		va = L::Set( a);
+	}
+	// median split of order[b,e[ along the widest axis of the centers; returns the node index
+	unsigned Split( std::vector<unsigned>& order, unsigned b, unsigned e, unsigned& slots) {
+		unsigned ni = m_nodes.size();
+		m_nodes.push_back( CNode());
+		CNode nd;
+		T clo[3], chi[3];
+		for (unsigned ii = 0; ii < 3; ii++) {
+			nd.lo[ii] = clo[ii] = HUGE_VAL;
+			nd.hi[ii] = chi[ii] = -HUGE_VAL;
+		}
+		nd.solid = 0;
+		for (unsigned jj = b; jj < e; jj++) {
+			unsigned k = order[jj];
+			T r = sqrt( m_p[R2 * m_cap + k]) + m_eps;
+			for (unsigned ii = 0; ii < 3; ii++) {
+				T c = m_p[(CX + ii) * m_cap + k];
+				nd.lo[ii] = std::min( nd.lo[ii], c - r);
+				nd.hi[ii] = std::max( nd.hi[ii], c + r);
+				clo[ii] = std::min( clo[ii], c);
+				chi[ii] = std::max( chi[ii], c);
+			}
+			if (!m_p[HOLLOW * m_cap + k])
+				nd.solid = 1;
+		}
+		nd.right = nd.axis = 0;
+		if (e - b <= LEAF) {
+			nd.n = e - b;
+			nd.first = slots;
+			slots += (nd.n + LANES - 1) / LANES * LANES;
+			nd.end = slots;
+		} else {
+			for (unsigned ii = 1; ii < 3; ii++) {
+				if (chi[ii] - clo[ii] > chi[nd.axis] - clo[nd.axis])
+					nd.axis = ii;
+			}
+			nd.n = nd.first = nd.end = 0;
+			unsigned mid = (b + e) / 2;
+			const T *c = &m_p[(CX + nd.axis) * m_cap];
+			std::nth_element( order.begin() + b, order.begin() + mid, order.begin() + e, [c]( unsigned i, unsigned j) {
+				return c[i] < c[j];
+			});
+			Split( order, b, mid, slots);
+			nd.right = Split( order, mid, e, slots);
+		}
+		m_nodes[ni] = nd;
+		return ni;
+	}
+	// slab test of o + t * v, 0 <= t <= tmax, against the node bounds (inv = 1 / v)
+	static int Box( const CNode& nd, const T *o, const T *v, const T *inv, T tmax) {
+		T lo = 0, hi = tmax;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			if (v[ii] == 0) {
+				if ((o[ii] < nd.lo[ii]) || (o[ii] > nd.hi[ii]))
+					return 0;
+				continue;
+			}
+			T t0 = (nd.lo[ii] - o[ii]) * inv[ii];
+			T t1 = (nd.hi[ii] - o[ii]) * inv[ii];
+			if (t0 > t1)
+				std::swap( t0, t1);
+			if (t0 > lo)
+				lo = t0;
+			if (t1 < hi)
+				hi = t1;
+			if (lo > hi)
+				return 0;
+		}
+		return 1;
+	}
+	static void Inverse( const T *v, T *inv) {
+		for (unsigned ii = 0; ii < 3; ii++) {
+			inv[ii] = 1 / v[ii];
+		}
+	}
+	// children of inner node nd, nearest first along its split axis
+	void Push( const CNode& nd, const T *v, unsigned *stack, unsigned& sp) const {
+		unsigned left = &nd - &m_nodes[0] + 1;
+		if (v[nd.axis] > 0) {
+			stack[sp++] = nd.right;
+			stack[sp++] = left;
+		} else {
+			stack[sp++] = left;
+			stack[sp++] = nd.right;
+		}
+	}
+	// nodes farther than tlim are skipped
+	template<class L> unsigned ClosestK( const T *o, const T *v, T tlim, T& tbest) const {
+		typedef typename L::V V;
+		V vo[3], vv[3], a;
+		Setup<L>( o, v, vo, vv, a);
+		T inv[3];
+		Inverse( v, inv);
+		V best = L::Set( HUGE_VAL);
+		V zero = L::Set( 0);
+		// per lane best t, object index and slot (stored as Ts, exact below 2^53)
+		// the initial index of -1 keeps misses (t = HUGE_VAL) out
+		V ibest = L::Set( -1);
+		V kbest = L::Set( -1);
+		T lanes[L::N];
+		for (unsigned ii = 0; ii < L::N; ii++)
+			lanes[ii] = ii;
+		V klane = LoadU<L>( lanes);
+		unsigned stack[STACK];
+		unsigned sp = 0;
+		stack[sp++] = 0;
+		while (sp) {
+			const CNode& nd = m_nodes[stack[--sp]];
+			STAT( NODES, 1);
+			if (!Box( nd, o, v, inv, tlim))
+				continue;
+			if (!nd.n) {
+				Push( nd, v, stack, sp);
+				continue;
+			}
+			STAT( TESTS, nd.end - nd.first);
+			for (unsigned k = nd.first; k < nd.end; k += L::N) {
+				V t = Intersec<L>( k, vo, vv, a);
+				V idx = L::Load( &m_p[IDX * m_cap + k]);
+				auto hit = L::And( L::Gt( t, zero), L::Or( L::Lt( t, best), L::And( L::Eq( t, best), L::Lt( idx, ibest))));
+				best = L::Select( hit, t, best);
+				ibest = L::Select( hit, idx, ibest);
+				kbest = L::Select( hit, L::Add( L::Set( k), klane), kbest);
+			}
+			T bt[L::N];
+			StoreU<L>( bt, best);
+			for (unsigned ii = 0; ii < L::N; ii++) {
+				if (bt[ii] < tlim)
+					tlim = bt[ii];
+			}
+		}
+		T bt[L::N], bi[L::N], bk[L::N];
+		StoreU<L>( bt, best);
+		StoreU<L>( bi, ibest);
+		StoreU<L>( bk, kbest);
+		unsigned kmin = NONE;
+		T imin = 0;
+		for (unsigned ii = 0; ii < L::N; ii++) {
+			if (bk[ii] < 0)
+				continue;
+			if ((kmin == NONE) || (bt[ii] < tbest) || ((bt[ii] == tbest) && (bi[ii] < imin))) {
+				tbest = bt[ii];
+				imin = bi[ii];
+				kmin = bk[ii];
+			}
+		}
+		return kmin;
+	}
+	// one sphere at a time against L::N rays (n <= L::N valid) of common origin o
+	// a node is visited when any of the rays may hit it
+	template<class L> void ClosestRaysK( const T *o, const T *v, unsigned n, T *tbest, unsigned *kbest) const {
+		typedef typename L::V V;
+		T lv[3][L::N];
+		for (unsigned ii = 0; ii < L::N; ii++) {
+			unsigned r = ii < n ? ii : n - 1;	// spare lanes replay the last ray
+			for (unsigned jj = 0; jj < 3; jj++) {
+				lv[jj][ii] = v[r * 3 + jj];
+			}
+		}
+		T inv[L::N][3];
+		T tlim[L::N];
+		for (unsigned ii = 0; ii < n; ii++) {
+			Inverse( v + ii * 3, inv[ii]);
+			tlim[ii] = HUGE_VAL;
+		}
+		V zero = L::Set( 0);
+		V vv[3];
+		for (unsigned jj = 0; jj < 3; jj++) {
+			vv[jj] = LoadU<L>( lv[jj]);
+		}
+		V a = L::Add( L::Add( L::Add( zero, L::Mul( vv[0], vv[0])), L::Mul( vv[1], vv[1])), L::Mul( vv[2], vv[2]));
+		V a4 = L::Mul( L::Set( 4), a);
+		V two = L::Set( 2);
+		V best = L::Set( HUGE_VAL);
+		V ib = L::Set( -1);
+		V kb = L::Set( -1);
+		unsigned stack[STACK];
+		unsigned sp = 0;
+		stack[sp++] = 0;
+		while (sp) {
+			const CNode& nd = m_nodes[stack[--sp]];
+			STAT( NODES, n);
+			int any = 0;
+			for (unsigned ii = 0; (ii < n) && !any; ii++) {
+				any = Box( nd, o, v + ii * 3, inv[ii], tlim[ii]);
+			}
+			if (!any)
+				continue;
+			if (!nd.n) {
+				Push( nd, v, stack, sp);
+				continue;
+			}
+			STAT( TESTS, (nd.end - nd.first) * n);
+			for (unsigned k = nd.first; k < nd.end; k++) {
+				// per sphere, shared by the whole packet
+				T tx = o[0] - m_p[CX * m_cap + k];
+				T ty = o[1] - m_p[CY * m_cap + k];
+				T tz = o[2] - m_p[CZ * m_cap + k];
+				T tt = 0;
+				tt += tx * tx;
+				tt += ty * ty;
+				tt += tz * tz;
+				V c = L::Set( tt - m_p[R2 * m_cap + k]);
+				V vt = L::Add( L::Add( L::Add( zero, L::Mul( vv[0], L::Set( tx))), L::Mul( vv[1], L::Set( ty))), L::Mul( vv[2], L::Set( tz)));
+				V b = L::Mul( two, vt);
+				V d = L::Sub( L::Mul( b, b), L::Mul( a4, c));
+				auto pos = L::Gt( d, zero);
+				auto nul = L::Eq( d, zero);
+				if (!L::Mask( pos) && !L::Mask( nul))
+					continue;	// the whole packet misses this sphere
+				V nb = L::Neg( b);
+				V sd = L::Sqrt( L::Select( pos, d, zero));
+				V t1 = L::Div( L::Div( L::Sub( nb, sd), two), a);
+				V t2 = L::Div( L::Div( L::Add( nb, sd), two), a);
+				V t0 = L::Div( L::Div( nb, two), a);
+				V t = L::Select( pos, L::Min( t1, t2), L::Select( nul, t0, L::Set( HUGE_VAL)));
+				V idx = L::Set( m_p[IDX * m_cap + k]);
+				auto hit = L::And( L::Gt( t, zero), L::Or( L::Lt( t, best), L::And( L::Eq( t, best), L::Lt( idx, ib))));
+				best = L::Select( hit, t, best);
+				ib = L::Select( hit, idx, ib);
+				kb = L::Select( hit, L::Set( k), kb);
+			}
+			StoreU<L>( tlim, best);
+		}
+		T bk[L::N];
+		StoreU<L>( tbest, best);
+		StoreU<L>( bk, kb);
+		for (unsigned ii = 0; ii < n; ii++) {
+			kbest[ii] = bk[ii] < 0 ? (unsigned)NONE : (unsigned)bk[ii];
+		}
+	}
+	template<class L> int OccludedK( const T *o, const T *v, T dmax, unsigned skip) const {
+		typedef typename L::V V;
+		V vo[3], vv[3], a;
+		Setup<L>( o, v, vo, vv, a);
+		T inv[3];
+		Inverse( v, inv);
+		V zero = L::Set( 0);
+		V vdmax = L::Set( dmax);
+		unsigned stack[STACK];
+		unsigned sp = 0;
+		stack[sp++] = 0;
+		while (sp) {
+			const CNode& nd = m_nodes[stack[--sp]];
+			STAT( NODES, 1);
+			if (!nd.solid || !Box( nd, o, v, inv, dmax))
+				continue;	// lamps (hollow) never block
+			if (!nd.n) {
+				Push( nd, v, stack, sp);
+				continue;
+			}
+			STAT( TESTS, nd.end - nd.first);
+			for (unsigned k = nd.first; k < nd.end; k += L::N) {
+				V t = Intersec<L>( k, vo, vv, a);
+				auto cand = L::And( L::And( L::Gt( t, zero), L::Lt( t, vdmax)), L::Eq( L::Load( &m_p[HOLLOW * m_cap + k]), zero));
+				int mask = L::Mask( cand);
+				for (unsigned ii = 0; mask; ii++, mask >>= 1) {
+					if ((mask & 1) && (Index( k + ii) != skip))
+						return 1;
+				}
+			}
+		}
+		return 0;
+	}
+	template<class L> static typename L::V LoadU( const T *p) {
+		typename L::V r;
+		memcpy( &r, p, sizeof( r));
+		return r;
+	}
+	template<class L> static void StoreU( T *p, typename L::V a) {
+		memcpy( p, &a, sizeof( a));
+	}
+	// arrays are grown by powers of two, each field aligned on 32 bytes
+	void Grow() {
+		unsigned cap = m_cap ? m_cap * 2 : 64;
+		std::vector<T> buf( FIELDS * cap + ALIGN);
+		T *p = Align( &buf[0]);
+		for (unsigned f = 0; f < FIELDS; f++) {
+			for (unsigned k = 0; k < m_n; k++) {
+				p[f * cap + k] = m_p[f * m_cap + k];
+			}
+		}
+		m_buf.swap( buf);
+		m_p = p;
+		m_cap = cap;
+	}
+	static T *Align( T *p) {
+		return (T *)(((uintptr_t)p + 31) & ~(uintptr_t)31);
+	}
+	// void spheres never hit : c = +inf => negative discriminant
+	static void Void( T *p, unsigned cap, unsigned k) {
+		for (unsigned f = 0; f < FIELDS; f++) {
+			p[f * cap + k] = 0;
+		}
+		p[R2 * cap + k] = -HUGE_VAL;
+		p[HOLLOW * cap + k] = 1;
+	}
+	// lanes past the last sphere
+	void Pad() {
+		for (unsigned k = m_n; (k % LANES) && (k < m_cap); k++) {
+			Void( m_p, m_cap, k);
+		}
+	}
+	unsigned m_n;		// number of spheres
+	unsigned m_cap;		// allocated slots per field (multiple of LANES)
+	std::vector<T> m_buf;
+	T *m_p;		// FIELDS arrays of m_cap Ts
+	std::vector<CNode> m_nodes;	// hierarchy, root first (empty until Build)
+	T m_eps;		// bounds inflation
+};
+
+#endif/*CSPHERES_H*/
@@ -0,0 +1,138 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef CSTATS_H
+#define CSTATS_H
+
+// per-frame hot path counters and phase timings (make USE_STATS=1)
+// counters are bumped in thread local storage by STAT( counter, n) and gathered into the frame
+// totals at the end of each render job (STAT_GATHER); phases are timed with a monotonic clock by
+// STAT_PHASE; without USE_STATS, these macros compile to nothing and CStats is never touched
+#ifdef USE_STATS
+#define STAT( c, n) (CStats::Local()[CStats::c] += (n))
+#define STAT_PHASE( stats, p) CStats::CPhase stat_phase_( stats, CStats::p)
+#define STAT_GATHER( stats) (stats).Gather()
+#else
+#define STAT( c, n) ((void)0)
+#define STAT_PHASE( stats, p) ((void)0)
+#define STAT_GATHER( stats) ((void)0)
+#endif
+
+#include <stdio.h>
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+
+class CStats {
+public:
+	enum {
+		PRIMARY,	// camera rays
+		REFLECTED,	// reflection bounces
+		SHADOW,		// lamp shadow rays
+		APERTURE,	// geometry-only rays of the lamp aperture pass
+		SAMPLES,	// anti-aliasing sub-pixel rays
+		NODES,		// bounding boxes tested
+		TESTS,		// ray/object intersection tests (sphere lanes included)
+		COUNTERS
+	};
+	enum { PREPARE, FRAME, RENDER, REFINE, DRAW, EVENTS, OUTPUT, PHASES };
+	struct CCounters {
+		unsigned long long c[COUNTERS];
+		unsigned long long& operator[]( unsigned ii) {
+			return c[ii];
+		}
+		void Clear() {
+			for (unsigned ii = 0; ii < COUNTERS; ii++) {
+				c[ii] = 0;
+			}
+		}
+	};
+	// adds the lifetime of the object to a phase
+	class CPhase {
+	public:
+		CPhase( CStats& stats, unsigned phase) :
+			m_stats( stats),
+			m_phase( phase),
+			m_t0( std::chrono::steady_clock::now()) {
+		}
+		~CPhase() {
+			m_stats.m_cur.phase[m_phase] += std::chrono::duration<double>( std::chrono::steady_clock::now() - m_t0).count();
+		}
+	private:
+		CStats& m_stats;
+		unsigned m_phase;
+		std::chrono::steady_clock::time_point m_t0;
+	};
+	CStats() : m_frames( 0) {
+		m_cur.Clear();
+		m_last.Clear();
+		Local().Clear();
+	}
+	// counters of the calling thread, not yet gathered
+	static CCounters& Local() {
+		static thread_local CCounters local = CCounters();
+		return local;
+	}
+	// moves the calling thread counters into the current frame (end of each render job)
+	void Gather() {
+		CCounters& local = Local();
+		std::lock_guard<std::mutex> lock( m_mutex);
+		for (unsigned ii = 0; ii < COUNTERS; ii++) {
+			m_cur.c[ii] += local[ii];
+		}
+		local.Clear();
+	}
+	// a new frame starts (the previous one may not have been completed)
+	void Begin() {
+		Gather();
+		m_cur.Clear();
+	}
+	// the current frame is complete : it becomes the one reported
+	void End() {
+		Gather();
+		m_last = m_cur;
+		m_last.frame = ++m_frames;
+	}
+	// "frame 12: 3.1 ms render, 0.4 Mrays/s" (window title)
+	void Title( char *buf, size_t size) const {
+		double rays = m_last.c[PRIMARY] + m_last.c[SAMPLES] + m_last.c[REFLECTED] + m_last.c[SHADOW];
+		double render = m_last.phase[FRAME] + m_last.phase[RENDER] + m_last.phase[REFINE];
+		snprintf( buf, size, "realist frame %u: %.1f ms render, %.2f Mrays/s, %.1f ms draw", m_last.frame, render * 1e3, render > 0 ? rays / render / 1e6 : 0.0, m_last.phase[DRAW] * 1e3);
+	}
+	void Json( std::ostream& out) const {
+		static const char *counters[COUNTERS] = { "primary", "reflected", "shadow", "aperture", "aa", "nodes", "tests"};
+		static const char *phases[PHASES] = { "prepare", "frame", "render", "refine", "draw", "events", "output"};
+		out << "{ \"frame\": " << m_last.frame << ", \"counters\": { ";
+		for (unsigned ii = 0; ii < COUNTERS; ii++) {
+			out << (ii ? ", \"" : "\"") << counters[ii] << "\": " << m_last.c[ii];
+		}
+		out << " }, \"phases_ms\": { ";
+		for (unsigned ii = 0; ii < PHASES; ii++) {
+			out << (ii ? ", \"" : "\"") << phases[ii] << "\": " << m_last.phase[ii] * 1e3;
+		}
+		out << " } }" << std::endl;
+	}
+private:
+	struct CFrame {
+		unsigned long long c[COUNTERS];
+		double phase[PHASES];	// seconds
+		unsigned frame;
+		void Clear() {
+			for (unsigned ii = 0; ii < COUNTERS; ii++) {
+				c[ii] = 0;
+			}
+			for (unsigned ii = 0; ii < PHASES; ii++) {
+				phase[ii] = 0;
+			}
+			frame = 0;
+		}
+	};
+	std::mutex m_mutex;
+	CFrame m_cur;		// frame being rendered
+	CFrame m_last;		// last complete frame
+	unsigned m_frames;
+};
+
+#endif/*CSTATS_H*/
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# cross-implementation benchmark runner : every implementation is run several times at
+# several sizes; wall/user time, max RSS and rays/s are collected into JSON and/or CSV,
+# and compared against a stored baseline (exit status 1 on a throughput regression)
+#
+# usage: ./benchrun.py [-i impl,...] [-s WxH,...] [-n samples] [-T threads] [-r runs] [-j out.json] [-c out.csv]
+#                      [-b baseline.json] [-t threshold] [--save-baseline baseline.json] [--no-build]
+import argparse
+import csv
+import datetime
+import json
+import os
+import platform
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+
+# name : (build command, run command, rays per image, output redirected from stdout ?, working directory)
+# commands are formatted with w, h, ns (samples per pixel), threads and out (output image), and run
+# from the working directory (relative to the repository root)
+# rays counts primary rays only (rtiow/rttnw trace ns of them per pixel)
+# the multi-threaded implementations are given the threads count explicitly, so that results
+# stay comparable across machines
+RTTNW = 'rtiow/rttnw/CPP'
+RTTNW11 = (['make', '-C', RTTNW, 'rttnw11.elf'], './rttnw11.elf')
+IMPLS = {
+	'rayc': (['make', 'rayc'], ['./rayc', '{w}', '{h}', '{out}'], lambda w, h, ns: w * h, False, '.'),
+	'raycpp': (['make', 'raycpp'], ['./raycpp', '{w}', '{h}', '{out}'], lambda w, h, ns: w * h, False, '.'),
+	'realist': (['make', 'realist'], ['./realist', 'spyr.real', '{w}', '{h}', '1', '{threads}'], lambda w, h, ns: w * h, True, '.'),
+	'rtiow-main14': (['make', '-C', 'rtiow/CPP', 'main14.elf'], ['rtiow/CPP/main14.elf', '{w}', '{h}', '{ns}', '{out}'], lambda w, h, ns: w * h * ns, False, '.'),
+	# rttnw11 scenes (final loads earthmap.jpg from the working directory)
+	'rttnw11': (RTTNW11[0], [RTTNW11[1], '{w}', '{h}', '{ns}', 'cornell_box', 'sah', '{threads}'], lambda w, h, ns: w * h * ns, True, RTTNW),
+	'rttnw11-final': (RTTNW11[0], [RTTNW11[1], '{w}', '{h}', '{ns}', 'final', 'sah', '{threads}'], lambda w, h, ns: w * h * ns, True, RTTNW),
+	'rttnw11-random_scene': (RTTNW11[0], [RTTNW11[1], '{w}', '{h}', '{ns}', 'random_scene', 'sah', '{threads}'], lambda w, h, ns: w * h * ns, True, RTTNW),
+}
+
+def median(l):
+	l = sorted(l)
+	return l[len(l) // 2]
+
+# one run : wall and user/sys seconds, max RSS (KiB) of the child (wait4 rusage)
+# the kernel counts the forked runner before exec into the child max RSS : values at the floor
+# of the runner own size (a few MiB with a plain fork, more with subprocess) just mean "below"
+def run(cmd, out, redirect, cwd):
+	t0 = time.monotonic()
+	pid = os.fork()
+	if pid == 0:
+		try:
+			os.chdir(os.path.join(ROOT, cwd))
+			null = os.open(os.devnull, os.O_WRONLY)
+			os.dup2(os.open(out, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644) if redirect else null, 1)
+			os.dup2(null, 2)
+			os.execv(cmd[0], cmd)
+		finally:
+			os._exit(127)
+	_, status, ru = os.wait4(pid, 0)
+	wall = time.monotonic() - t0
+	if status:
+		raise RuntimeError('%s failed (status %d)' % (' '.join(cmd), status))
+	return wall, ru.ru_utime, ru.ru_stime, ru.ru_maxrss
+
+# results of another threads count are not comparable (single-threaded before the count was recorded)
+def key(r):
+	return '%s@%dx%dx%dt%d' % (r['impl'], r['w'], r['h'], r['samples'], r.get('threads', 1))
+
+def main():
+	ap = argparse.ArgumentParser(description='cross-implementation benchmark runner')
+	ap.add_argument('-i', '--impls', default=','.join(IMPLS), help='implementations (%s)' % ','.join(IMPLS))
+	ap.add_argument('-s', '--sizes', default='200x150,400x300', help='image sizes, WxH,...')
+	ap.add_argument('-n', '--samples', type=int, default=4, help='samples per pixel (rtiow/rttnw)')
+	ap.add_argument('-T', '--threads', type=int, default=1, help='threads of the multi-threaded implementations (realist, rttnw11)')
+	ap.add_argument('-r', '--runs', type=int, default=3, help='runs per case (median reported)')
+	ap.add_argument('-j', '--json', help='JSON results file')
+	ap.add_argument('-c', '--csv', help='CSV results file')
+	ap.add_argument('-b', '--baseline', help='baseline JSON to compare against')
+	ap.add_argument('-t', '--threshold', type=float, default=0.10, help='tolerated rays/s loss vs baseline (0.10 => 10%%)')
+	ap.add_argument('--save-baseline', help='also write the results as a baseline')
+	ap.add_argument('--no-build', action='store_true', help='do not (re)build the implementations')
+	args = ap.parse_args()
+
+	impls = [i for i in args.impls.split(',') if i]
+	for i in impls:
+		if i not in IMPLS:
+			ap.error('unknown implementation %s' % i)
+	sizes = []
+	for s in args.sizes.split(','):
+		w, h = s.split('x')
+		sizes.append((int(w), int(h)))
+
+	results = []
+	print('%-20s %10s %8s %7s %9s %9s %10s %14s' % ('# impl', 'size', 'samples', 'threads', 'wall(s)', 'user(s)', 'maxrss(K)', 'rays/s'))
+	for i in impls:
+		build, cmd, nrays, redirect, cwd = IMPLS[i]
+		if not args.no_build:
+			subprocess.check_call(build, cwd=ROOT, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+		for w, h in sizes:
+			ns = args.samples
+			out = os.path.join(ROOT, 'bench_%s.ppm' % i)
+			argv = [a.format(w=w, h=h, ns=ns, threads=args.threads, out=out) for a in cmd]
+			runs = [run(argv, out, redirect, cwd) for _ in range(args.runs)]
+			walls = [r[0] for r in runs]
+			rays = nrays(w, h, ns)
+			r = {
+				'impl': i, 'w': w, 'h': h, 'samples': ns if '{ns}' in cmd else 1,
+				'threads': args.threads if '{threads}' in cmd else 1, 'runs': args.runs,
+				'wall': median(walls), 'wall_min': min(walls),
+				'user': median([r[1] for r in runs]), 'sys': median([r[2] for r in runs]),
+				'maxrss_kb': max([r[3] for r in runs]),
+				'rays': rays, 'rays_per_s': rays / median(walls),
+			}
+			results.append(r)
+			print('%-20s %10s %8d %7d %9.3f %9.3f %10d %14.0f' % (i, '%dx%d' % (w, h), r['samples'], r['threads'], r['wall'], r['user'], r['maxrss_kb'], r['rays_per_s']))
+			sys.stdout.flush()
+
+	doc = {
+		'date': datetime.datetime.now().isoformat(timespec='seconds'),
+		'host': platform.node(), 'machine': platform.machine(), 'cpus': os.cpu_count(),
+		'revision': subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], cwd=ROOT, capture_output=True, text=True).stdout.strip(),
+		'results': results,
+	}
+	for f in (args.json, args.save_baseline):
+		if f:
+			with open(f, 'w') as fp:
+				json.dump(doc, fp, indent=1)
+	if args.csv:
+		with open(args.csv, 'w', newline='') as fp:
+			wr = csv.DictWriter(fp, fieldnames=list(results[0].keys()) if results else ['impl'])
+			wr.writeheader()
+			wr.writerows(results)
+
+	status = 0
+	if args.baseline:
+		with open(args.baseline) as fp:
+			base = dict((key(r), r) for r in json.load(fp)['results'])
+		for r in results:
+			b = base.get(key(r))
+			if not b:
+				print('%-36s no baseline' % key(r))
+				continue
+			ratio = r['rays_per_s'] / b['rays_per_s']
+			verdict = 'ok'
+			if ratio < 1 - args.threshold:
+				verdict = 'REGRESSION'
+				status = 1
+			print('%-36s %14.0f vs %14.0f rays/s  %+6.1f%%  %s' % (key(r), r['rays_per_s'], b['rays_per_s'], (ratio - 1) * 100, verdict))
+	return status
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,165 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+// microbenchmarks of the intersection and vector kernels (see CBench.h)
+// the kernels are those of the programs, from the headers they include
+#include <string.h>
+
+#include <vector>
+
+#include "raycpp.h"
+#include "CSpheres.h"
+#include "CBench.h"
+
+void RttnwBench( CBench& b);		// microbench_rttnw.cpp
+
+enum { N = 1024 };		// inputs per case (a power of two, cycled through)
+
+int main( int argc, char *argv[]) {
+	const char *filter = 0;
+	double mintime = 0.05;
+	int arg = 1;
+	if (arg < argc) {
+		filter = argv[arg++];
+		if (!strcmp( filter, "-"))
+			filter = 0;
+		if (arg < argc) {
+			unsigned ms;
+			if (sscanf( argv[arg++], "%u", &ms) == 1)
+				mintime = ms / 1000.0;
+		}
+	}
+	CBench b( filter, mintime);
+	CRand rnd;
+
+	// quadratic solver
+	std::vector<double> qa( N), qb( N), qc( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		qa[ii] = rnd.Next( 0.5, 2);
+		qb[ii] = rnd.Next( -4, 4);
+		qc[ii] = rnd.Next( -2, 2);
+	}
+	b.Run( "solvetri", [&]( unsigned ii) {
+		ii %= N;
+		double t1 = 0, t2 = 0;
+		return solvetri( qa[ii], qb[ii], qc[ii], &t1, &t2) + t1;
+	});
+
+	// rays from a 5 units shell around the origin, aimed at the unit sphere area (most hit it)
+	std::vector<v3> ro( N), rv( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		v3 o( rnd.Next( -1, 1), rnd.Next( -1, 1), rnd.Next( -1, 1));
+		ro[ii] = ~o * 5;
+		v3 target( rnd.Next( -1.2, 1.2), rnd.Next( -1.2, 1.2), rnd.Next( -1.2, 1.2));
+		rv[ii] = ~(target - ro[ii]);
+	}
+	double sph[CSphere::MAX] = { 0, 1, 1, 1, 0, 0, 0, 1};
+	CSphere sphere( sph);
+	b.Run( "CSphere::Intersec", [&]( unsigned ii) {
+		ii %= N;
+		double t = sphere.Intersec( ro[ii], rv[ii]);
+		return t < HUGE_VAL ? t : 0;
+	});
+	b.Run( "CSphere::Occluded", [&]( unsigned ii) {
+		ii %= N;
+		return (double)sphere.Occluded( ro[ii], rv[ii], 5);
+	});
+	double pl[CPlane::MAX] = { 0, 1, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0};
+	CPlane plane( pl);
+	b.Run( "CPlane::Intersec", [&]( unsigned ii) {
+		ii %= N;
+		double t = plane.Intersec( ro[ii], rv[ii]);
+		return t < HUGE_VAL ? t : 0;
+	});
+
+	// sphere store (BVH + SIMD lanes) on a field of small spheres, double and float
+	CSpheresT<double> spheres;
+	CSpheresT<float> fspheres;
+	for (unsigned ii = 0; ii < 10000; ii++) {
+		double c[3] = { rnd.Next( -10, 10), rnd.Next( -10, 10), rnd.Next( -10, 10)};
+		double col[3] = { 1, 1, 1};
+		spheres.Add( c, 0.1, col, 0, ii);
+		float fc[3] = { (float)c[0], (float)c[1], (float)c[2]};
+		float fcol[3] = { 1, 1, 1};
+		fspheres.Add( fc, 0.1f, fcol, 0, ii);
+	}
+	spheres.Build();
+	fspheres.Build();
+	std::vector<vec<double> > fo( N), fv( N);
+	std::vector<v3f> ffo( N), ffv( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		fo[ii] = vec<double>( rnd.Next( -1, 1), rnd.Next( -1, 1), 15);
+		fv[ii] = ~(vec<double>( rnd.Next( -10, 10), rnd.Next( -10, 10), 0) - fo[ii]);
+		ffo[ii] = v3f( &fo[ii][0]);
+		ffv[ii] = v3f( &fv[ii][0]);
+	}
+	b.Run( "CSpheres::Closest (10k)", [&]( unsigned ii) {
+		ii %= N;
+		double t = HUGE_VAL;
+		unsigned idx = CSpheres::NONE;
+		spheres.Closest( &fo[ii][0], &fv[ii][0], t, idx);
+		return t < HUGE_VAL ? t : 0;
+	});
+	b.Run( "CSpheres::Occluded (10k)", [&]( unsigned ii) {
+		ii %= N;
+		return (double)spheres.Occluded( &fo[ii][0], &fv[ii][0], 30, CSpheres::NONE);
+	});
+	b.Run( "CSpheres::Closest f32 (10k)", [&]( unsigned ii) {
+		ii %= N;
+		float t = HUGE_VAL;
+		unsigned idx = CSpheres::NONE;
+		fspheres.Closest( &ffo[ii][0], &ffv[ii][0], t, idx);
+		return t < HUGE_VAL ? (double)t : 0;
+	});
+	b.Run( "CSpheres::Occluded f32 (10k)", [&]( unsigned ii) {
+		ii %= N;
+		return (double)fspheres.Occluded( &ffo[ii][0], &ffv[ii][0], 30, CSpheres::NONE);
+	});
+
+	// vector operators, double and packed float
+	b.Run( "v3 +", [&]( unsigned ii) {
+		ii %= N;
+		return (ro[ii] + rv[ii])[0];
+	});
+	b.Run( "v3 * scalar", [&]( unsigned ii) {
+		ii %= N;
+		return (ro[ii] * qa[ii])[1];
+	});
+	b.Run( "v3 % (dot)", [&]( unsigned ii) {
+		ii %= N;
+		return ro[ii] % rv[ii];
+	});
+	b.Run( "v3 ^ (cross)", [&]( unsigned ii) {
+		ii %= N;
+		return (ro[ii] ^ rv[ii])[2];
+	});
+	b.Run( "v3 ~ (normalize)", [&]( unsigned ii) {
+		ii %= N;
+		return (~ro[ii])[0];
+	});
+	std::vector<v4f> fro( N), frv( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		fro[ii] = v4f( ro[ii][0], ro[ii][1], ro[ii][2]);
+		frv[ii] = v4f( rv[ii][0], rv[ii][1], rv[ii][2]);
+	}
+	b.Run( "v4f +", [&]( unsigned ii) {
+		ii %= N;
+		return (double)(fro[ii] + frv[ii])[0];
+	});
+	b.Run( "v4f % (dot)", [&]( unsigned ii) {
+		ii %= N;
+		return (double)(fro[ii] % frv[ii]);
+	});
+	b.Run( "v4f ^ (cross)", [&]( unsigned ii) {
+		ii %= N;
+		return (double)(fro[ii] ^ frv[ii])[2];
+	});
+	b.Run( "v4f ~ (normalize)", [&]( unsigned ii) {
+		ii %= N;
+		return (double)(~fro[ii])[0];
+	});
+
+	RttnwBench( b);
+	return 0;
+}
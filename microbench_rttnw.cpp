@@ -0,0 +1,67 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+// microbenchmarks of the rttnw (float) kernels : linked into microbench (see microbench.cpp)
+#include <cfloat>
+
+#include "rtiow/rttnw/CPP/sphere.h"
+#include "rtiow/rttnw/CPP/perlin.h"
+
+#include "CBench.h"
+
+void RttnwBench( CBench& b) {
+	enum { N = 1024 };
+	CRand rnd( 2);
+	// rays from the random_scene() camera towards its field of spheres
+	std::vector<ray> rays( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		vec3 o( 13 + rnd.Next( -1, 1), 2 + rnd.Next( -1, 1), 3 + rnd.Next( -1, 1));
+		vec3 target( rnd.Next( -11, 11), rnd.Next( 0, 1), rnd.Next( -11, 11));
+		rays[ii] = ray( o, unit_vector( target - o));
+	}
+	aabb box( vec3( -5, 0, -5), vec3( 5, 1, 5));
+	b.Run( "rttnw aabb::hit", [&]( unsigned ii) {
+		ii %= N;
+		return (double)box.hit( rays[ii], 0.001, FLT_MAX);
+	});
+	sphere sph( vec3( 0, 0.5, 0), 3, 0);
+	b.Run( "rttnw sphere::hit", [&]( unsigned ii) {
+		ii %= N;
+		hit_record rec;
+		return sph.hit( rays[ii], 0.001, FLT_MAX, rec) ? (double)rec.t : 0;
+	});
+	// same layout as random_scene(), denser : 10k small spheres over the field
+	enum { NS = 10000 };
+	hittable **list = new hittable*[NS];
+	for (unsigned ii = 0; ii < NS; ii++) {
+		list[ii] = new sphere( vec3( rnd.Next( -11, 11), 0.2, rnd.Next( -11, 11)), 0.2, 0);
+	}
+	hittable *bvh = new bvh_node( list, NS, 0, 1);
+	b.Run( "rttnw bvh_node::hit (10k)", [&]( unsigned ii) {
+		ii %= N;
+		hit_record rec;
+		return bvh->hit( rays[ii], 0.001, FLT_MAX, rec) ? (double)rec.t : 0;
+	});
+	bvh_width = 4;
+	hittable *qbvh = new bvh_node( list, NS, 0, 1);
+	bvh_width = 2;
+	b.Run( "rttnw bvh_wide<4>::hit (10k)", [&]( unsigned ii) {
+		ii %= N;
+		hit_record rec;
+		return qbvh->hit( rays[ii], 0.001, FLT_MAX, rec) ? (double)rec.t : 0;
+	});
+	std::vector<vec3> points( N);
+	for (unsigned ii = 0; ii < N; ii++) {
+		points[ii] = vec3( rnd.Next( -50, 50), rnd.Next( -50, 50), rnd.Next( -50, 50));
+	}
+	perlin noise;
+	b.Run( "rttnw perlin::noise", [&]( unsigned ii) {
+		ii %= N;
+		return (double)noise.noise( points[ii]);
+	});
+	b.Run( "rttnw perlin::turb", [&]( unsigned ii) {
+		ii %= N;
+		return (double)noise.turb( points[ii]);
+	});
+}
@@ -9,246 +9,12 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <functional>
 
-#include "vec.h"
-#include "veccpp.h"
-
-enum { OT_NONE = -1, OT_SPHERE = 0, OT_PLANE };
-class CObject {
-public:
-	CObject( int type = OT_NONE, int len = 0) : m_type( type), m_len( len), m_flags( 0), m_hollow(0) {
-	}
-	virtual ~CObject() {
-	}
-	// returns intersection distance (HUGE_VAL => no intersection)
-	virtual double Intersec( const v3& e, const v3& v) const = 0;
-	virtual v3 Normal( const v3& vint) const = 0;
-	virtual void SetColor( const double *color) {
-		m_color = color;
-	}
-	virtual const v3& Color() const {
-		return m_color;
-	}
-	virtual v3& Center() {
-		return m_c;
-	}
-	virtual const v3& Center() const {
-		return m_c;
-	}
-	virtual void SetHollow( const int& hollow) {
-		m_hollow = hollow;
-	}
-	const int& Hollow() const {
-		return m_hollow;
-	}
-	virtual std::ostream& Serialize( std::ostream& out) const {
-		out << m_type << " " << m_len << std::endl;
-		return out;
-	}
-	friend std::ostream& operator<<( std::ostream& out, const CObject& ob) {
-		return ob.Serialize( out);
-	}
-	virtual void Json( std::ostream& out) const = 0;
-protected:
-	int m_type;
-	int m_len;		// for serialization : total number of double excluding type and len
-//---------------
-	int m_flags;
-	v3 m_color;
-	int m_hollow;
-	v3 m_c;
-};
-
-typedef class CSphere CLamp;
-
-class CSphere : public CObject {
-public:
-	enum {
-		FLAGS, COLOR, COLOR_RED = COLOR, COLOR_GREEN, COLOR_BLUE, CENTER, CENTER_X = CENTER, CENTER_Y, CENTER_Z, RADIUS,
-//		A0, B0, C0, D0, E0, F0,
-		MAX
-	};
-	CSphere( const double *params) :
-		CObject( OT_SPHERE, MAX),
-		m_r( params[RADIUS]) {
-		m_c = &params[CENTER];
-		SetColor( &params[COLOR]);
-//		std::cout << *this << std::endl;
-	}
-	const double& Radius() const {
-		return m_r;
-	}
-	std::ostream& Serialize( std::ostream& out) const {
-		CObject::Serialize( out);
-		out << m_flags << std::endl;
-		out << m_color << std::endl;
-		out << m_c << std::endl;
-		out << m_r << std::endl;
-		return out;
-	}
-	void Json( std::ostream& out) const {
-		out << "{'type':'sphere', 'data': [";
-		m_c.Print( out);
-		out << ",\t";
-		out << m_r;
-		out << ",\t";
-		m_color.Print( out);
-		out << "]}";
-	}
-	double Intersec( const v3 &e, const v3 &v) const {
-		double result = HUGE_VAL;
-		double sr2 = m_r * m_r;
-		double a, b, c;
-		v3 t = e - m_c;
-		a = v % v;
-		b = 2 * (v % t);
-		c = (t % t) - sr2;
-		double t1 = 0, t2 = 0;
-		int sol = solvetri( a, b, c, &t1, &t2);
-		if (sol >= 1) {
-			if (sol > 1) {
-				if (t1 < t2) {
-					result = t1;
-				} else {
-					result = t2;
-				}
-			}
-			else {
-				result = t1;
-			}
-		}
-		return result;
-	}
-	v3 Normal( const v3& vint) const {
-		v3 nv = ~(vint - Center());
-		return nv;
-	}
-	friend std::ostream& operator<<( std::ostream& out, const CSphere& sp) {
-		out << "sphere: c=";
-		out << sp.Center();
-		out << " r=";
-		out << sp.Radius();
-		out << " col=";
-		out << sp.Color();
-		return out;
-	}
-private:
-	double m_r;
-};
-
-class CPlane : public CObject {
-public:
-	enum {
-		FLAGS, COLOR, COLOR_RED = COLOR, COLOR_GREEN, COLOR_BLUE,
-		LOC0, LOC0_X = LOC0, LOC0_Y, LOC0_Z,
-		LOC1, LOC1_X = LOC1, LOC1_Y, LOC1_Z,
-		LOC2, LOC2_X = LOC2, LOC2_Y, LOC2_Z,
-		MAX
-	};
-	CPlane( const double *params) :
-		CObject( OT_PLANE, MAX),
-		m_loc0( &params[LOC0]),
-		m_loc1( &params[LOC1]),
-		m_loc2( &params[LOC2])
-	{
-		SetColor( &params[COLOR]);
-		std::cout << *this << std::endl;
-	}
-	std::ostream& Serialize( std::ostream& out) const {
-		CObject::Serialize( out);
-		out << m_flags << std::endl;
-		out << m_color << std::endl;
-		out << m_loc0 << std::endl;
-		out << m_loc1 << std::endl;
-		out << m_loc2 << std::endl;
-		return out;
-	}
-	void Json( std::ostream& out) const {
-		out << "'plane': [";
-		m_loc0.Print( out);
-		out << ",\t";
-		m_loc1.Print( out);
-		out << ",\t";
-		m_loc2.Print( out);
-		out << ",\t";
-		m_color.Print( out);
-		out << "]";
-	}
-	double Intersec( const v3 &oi, const v3 &vi) const {
-		double res = HUGE_VAL;
-		v3 n = Normal( m_loc0);
-		v3 p = m_loc0 - oi;
-		double num = p % n;
-		double den = vi % n;
-		if (den == 0) {
-			if (num == 0) {
-				printf( "all intersections\n");
-			}
-			else {
-				printf( "no intersections\n");
-			}
-		}
-		else {
-//			printf( "to be computed\n");
-			double det;
-			double a, b, c, d, e, f, g, h, i;
-			v3 lb = oi + vi;
-			a = oi[0] - lb[0];
-			b = m_loc1[0] - m_loc0[0];
-			c = m_loc2[0] - m_loc0[0];
-			d = oi[1] - lb[1];
-			e = m_loc1[1] - m_loc0[1];
-			f = m_loc2[1] - m_loc0[1];
-			g = oi[2] - lb[2];
-			h = m_loc1[2] - m_loc0[2];
-			i = m_loc2[2] - m_loc0[2];
-			det = a * (e * i - f * h) - b * (i * d - f * g) + c * (d * h - e * g);
-			if (det > 0.001) {	// matrix is invertible
-				double A, B, C, D, E, F, G, H, I;
-				A = (e * i - f * h);
-				B = -(d * i - f * g);
-				C = (d * h - e * g);
-				D = -(b * i - c * h);
-				E = (a * i - c * g);
-				F = -(a * h - b * g);
-				G = (b * f - c * e);
-				H = -(a * f - c * d);
-				I = (a * e - b * d);
-				double t, u = 0, v = 0;
-				// p=p0+u*v1+v*v2
-				t = (A * (oi[0] - m_loc0[0]) + D * (oi[1] - m_loc0[1]) + G * (oi[2] - m_loc0[2])) / det;
-				u = (B * (oi[0] - m_loc0[0]) + E * (oi[1] - m_loc0[1]) + H * (oi[2] - m_loc0[2])) /det;
-				v = (C * (oi[0] - m_loc0[0]) + F * (oi[1] - m_loc0[1]) + I * (oi[2] - m_loc0[2])) / det;
-				if ((u >= 0 && u <= 1) && (v >= 0 && v <= 1) && ((u + v) <= 1)) {
-					if (t > 1) {
-						res = 1;
-					}
-				}
-			}
-		}
-		return res;
-	}
-	v3 Normal( const v3& vint) const {
-		v3 v1 = m_loc1 - vint;
-		v3 v2 = m_loc2 - vint;
-		v3 n;
-		n = ~(v1 ^ v2);
-		return n;
-	}
-	friend std::ostream& operator<<( std::ostream& out, const CPlane& pl) {
-		out << "plane: loc0=";
-		out << pl.m_loc0;
-		out << " loc1=";
-		out << pl.m_loc1;
-		out << " loc2=";
-		out << pl.m_loc2;
-		out << " col=";
-		out << pl.Color();
-		return out;
-	}
-private:
-	v3 m_loc0, m_loc1, m_loc2;
-};
+#include "raycpp.h"
+#include "CPnm.h"
+#include "CScene.h"
+#include "CSpheres.h"
 
 class CRealist {
 public:
@@ -272,7 +38,29 @@ public:
 		out << std::endl << "]" << std::endl;
 		out << "}" << std::endl;
 	}
+	// objects known to the scene files (0 => skipped)
+	static CObject *NewObject( unsigned type, unsigned len, const double *data) {
+		switch (type) {
+			case OT_SPHERE:
+				if (len >= CSphere::MAX)
+					return new CSphere( data);
+				break;
+			case OT_PLANE:
+			case OT_QUAD:
+				if (len >= CPlane::MAX)
+					return new CPlane( data, type);
+				break;
+		}
+		return 0;
+	}
+	// text (.real) or binary (.realb) scene, told apart by the binary magic
 	int LoadScene( const char *scene_file) {
+		CScene bin;
+		int res = bin.Open( scene_file);
+		if (res < 0)
+			return -1;
+		if (!res)
+			return LoadScene( bin);
 		int result = -1;
 		std::ifstream ifs( scene_file);
 		if (!ifs.is_open())
@@ -286,6 +74,8 @@ public:
 		for (unsigned ii = 0; ii < 3; ii++) {
 			ifs >> m_u[ii];
 		}
+		std::streampos objs = ifs.tellg();
+		std::vector<double> data;
 		while (!ifs.eof()) {
 			unsigned type;
 			unsigned len;
@@ -294,29 +84,84 @@ public:
 				break;
 			result = -1;
 			ifs >> len;
+			if (!ifs)
+				break;		// not a scene file, or an older untyped one (see LoadLegacy())
 //			printf( "read type=%u len=%u\n", type, len);
-			double *data = new double[len];
+			data.resize( len);
 			for (unsigned ii = 0; ii < len; ii++) {
 				if (ifs.eof())
 					break;
 				ifs >> data[ii];
 			}
-			if (ifs.eof())
+			if (ifs.eof() || !ifs)
 				break;
-			CObject *obj = 0;
-			switch (type) {
-				case OT_SPHERE:
-					obj = new CSphere( data);
-					break;
-			}
+			CObject *obj = NewObject( type, len, data.data());
 			if (obj)
 				m_objs.push_back( obj);
-			delete data;
 			result = 0;
 		}
+		if (result && m_objs.empty())
+			return LoadLegacy( ifs, objs);
 //		JsonScene( std::cout);
 		return result;
 	}
+	// older untyped text scene (see CScene::ReadLegacy) : its first object did not parse as a typed one
+	int LoadLegacy( std::ifstream& ifs, std::streampos objs) {
+		ifs.clear();
+		ifs.seekg( objs);
+		std::vector<double> data;
+		int n = CScene::ReadLegacy( ifs, data);
+		if (n <= 0)
+			return -1;
+		for (int ii = 0; ii < n; ii++) {
+			m_objs.push_back( NewObject( CScene::SPHERE, CScene::SPHERE_LEN, &data[ii * CScene::SPHERE_LEN]));
+		}
+		return 0;
+	}
+	// the spheres go straight from the mapped parameters to the sphere store (the next Prepare() only
+	// adds the objects created since), and their objects are built in a single block, m_loaded;
+	// the other objects are built one by one
+	int LoadScene( const CScene& bin) {
+		const double *cam = bin.Camera();
+		for (unsigned ii = 0; ii < 3; ii++) {
+			m_e[ii] = cam[ii];
+			m_f[ii] = cam[3 + ii];
+			m_u[ii] = cam[6 + ii];
+		}
+		unsigned nsph = 0;
+		for (const CScene::CRecord *rec = bin.First(); rec; rec = bin.Next( rec)) {
+			if ((rec->type == OT_SPHERE) && (rec->len >= CSphere::MAX))
+				nsph++;
+		}
+		m_loaded.clear();
+		m_loaded.reserve( nsph);	// no reallocation : m_objs points into it
+		m_objs.reserve( m_objs.size() + bin.Objects());
+		m_spheres.Clear();
+		for (const CScene::CRecord *rec = bin.First(); rec; rec = bin.Next( rec)) {
+			const double *params = CScene::Params( rec);
+			if ((rec->type == OT_SPHERE) && (rec->len >= CSphere::MAX)) {
+				real c[3], col[3];
+				for (unsigned ii = 0; ii < 3; ii++) {
+					c[ii] = params[CSphere::CENTER + ii];
+					col[ii] = params[CSphere::COLOR + ii];
+				}
+				m_spheres.Add( c, params[CSphere::RADIUS], col, 0, m_objs.size());
+				m_loaded.push_back( CSphere( params));
+				m_objs.push_back( &m_loaded.back());
+				continue;
+			}
+			CObject *obj = NewObject( rec->type, rec->len, params);
+			if (obj)
+				m_objs.push_back( obj);
+		}
+		m_filled = 1;
+		return 0;
+	}
+	// is obj one of the m_loaded block ? (not to be deleted on its own)
+	int Loaded( const CObject *obj) const {
+		std::less<const CObject *> less;
+		return !m_loaded.empty() && !less( obj, &m_loaded.front()) && less( obj, &m_loaded.back() + 1);
+	}
 	void OutScene( std::ostream& out) const {
 		out << m_e << std::endl;
 		out << m_f << std::endl;
@@ -326,16 +171,42 @@ public:
 			out << *(m_objs.at( ii)) << std::endl;
 		}
 	}
+	// binary if the file name ends with .realb, text otherwise
 	int SaveScene( const char *scene_file) const {
+		size_t n = strlen( scene_file);
+		if ((n >= 6) && !strcmp( scene_file + n - 6, ".realb"))
+			return SaveBinScene( scene_file);
 		std::ofstream f( scene_file);
 		OutScene( f);
 		return 0;
 	}
+	int SaveBinScene( const char *scene_file) const {
+		CScene::CWriter out;
+		double cam[9];
+		for (unsigned ii = 0; ii < 3; ii++) {
+			cam[ii] = m_e[ii];
+			cam[3 + ii] = m_f[ii];
+			cam[6 + ii] = m_u[ii];
+		}
+		if (out.Begin( scene_file, cam))
+			return -1;
+		std::vector<double> params;
+		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
+			const CObject *obj = m_objs.at( ii);
+			params.resize( obj->Len());
+			obj->Params( &params[0]);
+			if (out.Add( obj->Type(), obj->Len(), &params[0]))
+				return -1;
+		}
+		return out.End();
+	}
 #define W 1024
 #define H 768
 	CRealist( const char *scene_file = 0):
 		m_w(W),
-		m_h(H) {
+		m_h(H),
+		m_filled(0),
+		m_mode(DefaultMode()) {
 //		std::cout << "# initial #objects: " << m_objs.size() << std::endl;
 		const char *wfile_name = 0;
 		if (scene_file) {
@@ -374,6 +245,7 @@ public:
 			for (unsigned ii = 0; ii < (sizeof(sph) / sizeof(sph[0])); ii++) {
 				m_objs.push_back( new CSphere( sph[ii]));
 			}
+			m_objs.back()->SetHollow( 1);	// the last one is the lamp bulb : it must not shadow its own light
 #else
 // default scene : origins (unit vectors)
 			// camera
@@ -453,101 +325,192 @@ public:
 		}
 	}
 #define MAX_DEPTH 3
-	void Trace( int depth, const v3 &o, const v3 &v, v3 &color) const {
+#ifndef PACKET
+#define PACKET 2		// primary rays are traced by PACKET x PACKET packets (1 => one by one)
+#endif
+	// lighting modes (or'ed together), selected at run time : each combination has its own
+	// Trace<Flash, Refl, Lamp> instantiation, picked once per image
+	enum { FLASH = 1, REFL = 2, LAMP = 4, MODES = 8 };
+	// default mode, as set by the USE_FLASH/USE_REFL/USE_LAMP build flags
+	static int DefaultMode() {
+		int mode = 0;
+#ifdef USE_FLASH
+		mode |= FLASH;
+#endif
+#ifdef USE_REFL
+		mode |= REFL;
+#endif
+#ifdef USE_LAMP
+		mode |= LAMP;
+#endif
+		return mode;
+	}
+	// letters f (flash), r (reflections), l (lamps), anything else (eg: "-") => none
+	static int ParseMode( const char *s) {
+		int mode = 0;
+		for (; *s; s++) {
+			if (*s == 'f')
+				mode |= FLASH;
+			else if (*s == 'r')
+				mode |= REFL;
+			else if (*s == 'l')
+				mode |= LAMP;
+		}
+		return mode;
+	}
+	int Mode() const {
+		return m_mode;
+	}
+	void Mode( int mode) {
+		m_mode = mode & (MODES - 1);
+	}
+	template<int Flash, int Refl, int Lamp> void Trace( int depth, const v3 &o, const v3 &v, v3 &color) const {
 		if (depth > MAX_DEPTH)
 			return;
-		double tmin = HUGE_VAL;
-		CObject *omin = 0;
-//		unsigned imin = 0;
-		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-			double tres = m_objs.at( ii)->Intersec( o, v);
-			if ((tres > 0) && (tres < tmin)) {
+		real tmin = HUGE_VAL;
+		unsigned imin = CSpheres::NONE;
+		// spheres are batched in the SoA store, other primitives go through the virtual path
+		unsigned kmin = m_spheres.Closest( &o[0], &v[0], tmin, imin);
+		Others( o, v, tmin, imin, kmin);
+		Shade<Flash, Refl, Lamp>( depth, o, v, tmin, imin, color);
+	}
+	// traces n (<= PACKET * PACKET) rays of common origin o : spheres are tested for the whole packet
+	// at once, then each ray is shaded on its own (rays missing everything are just cleared)
+	template<int Flash, int Refl, int Lamp> void TracePacket( const v3 &o, const v3 *v, v3 *color, unsigned n) const {
+		real tmin[PACKET * PACKET];
+		unsigned imin[PACKET * PACKET];
+		unsigned kmin[PACKET * PACKET];
+		for (unsigned ii = 0; ii < n; ii++) {
+			tmin[ii] = HUGE_VAL;
+			imin[ii] = kmin[ii] = CSpheres::NONE;
+		}
+		m_spheres.ClosestPacket( &o[0], &v[0][0], n, tmin, imin, kmin);
+		for (unsigned ii = 0; ii < n; ii++) {
+			Others( o, v[ii], tmin[ii], imin[ii], kmin[ii]);
+			if (imin[ii] == CSpheres::NONE) {
+				color[ii] *= 0;
+				continue;
+			}
+			Shade<Flash, Refl, Lamp>( 0, o, v[ii], tmin[ii], imin[ii], color[ii]);
+		}
+	}
+	// non-sphere objects, closer than the current hit (ties go to the lowest object index,
+	// as a plain scan of m_objs would do)
+	void Others( const v3 &o, const v3 &v, real& tmin, unsigned& imin, unsigned& kmin) const {
+		for (unsigned jj = 0; jj < m_others.size(); jj++) {
+			unsigned ii = m_others.at( jj);
+			real tres = m_objs.at( ii)->Intersec( o, v);
+			if ((tres > 0) && (tres < HUGE_VAL) && ((tres < tmin) || ((tres == tmin) && (ii < imin)))) {
 				tmin = tres;
-				omin = m_objs.at( ii);
-//				imin = ii;
+				imin = ii;
+				kmin = CSpheres::NONE;
 			}
 		}
-		double def_color = 0;
+	}
+	// is the segment from o along unit direction v blocked by some opaque object (but skip) before dmax ?
+	// hollow objects (lamps) never block
+	int Occluded( const v3 &o, const v3 &v, real dmax, unsigned skip) const {
+		if (m_spheres.Occluded( &o[0], &v[0], dmax, skip))
+			return 1;
+		for (unsigned jj = 0; jj < m_others.size(); jj++) {
+			unsigned ii = m_others.at( jj);
+			const CObject *obj = m_objs.at( ii);
+			if ((ii == skip) || obj->Hollow())
+				continue;
+			if (obj->Occluded( o, v, dmax))
+				return 1;
+		}
+		return 0;
+	}
+	// color of the ray o + t * v hitting object imin at tmin
+	// the lighting tests are compile-time constants : disabled modes cost nothing
+	template<int Flash, int Refl, int Lamp> void Shade( int depth, const v3 &o, const v3 &v, real tmin, unsigned imin, v3 &color) const {
+		CObject *omin = 0;
+		if (imin != CSpheres::NONE)
+			omin = m_objs.at( imin);
+		real def_color = 0;
 		color *= def_color;
 		if (tmin < HUGE_VAL) {
-			double energy = 0;
-			// ambient
-#if defined USE_FLASH || defined USE_REFL || defined USE_LAMP
-			energy += 0.2;
+			real energy = 0;
 			v3 vint;
 			v3 nv;
-#else
-			energy += 1.0;
-#endif
+			// ambient
+			if (Flash || Refl || Lamp)
+				energy += 0.2;
+			else
+				energy += 1.0;
 //			printf( "[HIT %u]", imin);
 			// intersected object color
 			color = omin->Color() * 1.0;
-#if defined USE_FLASH || defined USE_REFL || defined USE_LAMP
-			// coords of intersec
-			vint = o + v * tmin;
-			// normal at intersec
-			nv = ~omin->Normal( vint);
-#endif
-#ifdef USE_FLASH
-			// camera flash
+			if (Flash || Refl || Lamp) {
+				// coords of intersec
+				vint = o + v * tmin;
+				// normal at intersec
+				nv = ~omin->Normal( vint);
+			}
+			if (Flash) {
+				// camera flash
 #define MAX_FLASH 0.1
-			double flash_nrj = 1 - energy;
-			if (flash_nrj > MAX_FLASH)
-				flash_nrj = MAX_FLASH;
-			double dist = !(vint - m_e);
+				real flash_nrj = 1 - energy;
+				if (flash_nrj > MAX_FLASH)
+					flash_nrj = MAX_FLASH;
+				real dist = !(vint - m_e);
 #define LAMP_FLOOR 0.4
-			if (dist < LAMP_FLOOR)
-				dist = LAMP_FLOOR;
-			energy += flash_nrj / dist / dist;
-#endif
-#ifdef USE_LAMP
-			// is there any object intersection between vint and a lamp ?
-			for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
-				if (omin == m_lamps.at( jj)) // skip current lamp==intersected object
-					continue;
-				v3 plamp = m_lamps.at( jj)->Center();
-				v3 vlamp = plamp - vint;
-				// is normal dot vlamp <= 0 (surface not exposed to light)
-				if ((vlamp % nv) <= 0)
-					continue;
-				double dlamp = !vlamp;
-				int shadowed = 0;
-				for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-					if (omin == m_objs.at( ii)) // skip current object=intersected object
+				if (dist < LAMP_FLOOR)
+					dist = LAMP_FLOOR;
+				energy += flash_nrj / dist / dist;
+			}
+			if (Lamp) {
+				// is there any object intersection between vint and a lamp ?
+				for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
+					if (omin == m_lamps.at( jj)) // skip current lamp==intersected object
+						continue;
+					v3 plamp = m_lamps.at( jj)->Center();
+					v3 vlamp = plamp - vint;
+					// is normal dot vlamp <= 0 (surface not exposed to light)
+					if ((vlamp % nv) <= 0)
 						continue;
-					double tres = m_objs.at( ii)->Intersec( vint, vlamp);
-					if ((tres > 0) && (tres < tmin)) {
-						v3 vint2 = vint + vlamp * tres;
-						double dint = !(vint2 - vint);
-						if ((dint < dlamp) && !m_objs.at( ii)->Hollow()) {
-							shadowed = 1;
-							break;
-						}
+					real dlamp = !vlamp;
+					int shadowed = Occluded( vint, vlamp / dlamp, dlamp, imin);
+					if (!shadowed) {
+						real nrj = 0.1 * 1.0 / dlamp / dlamp;
+						if (nrj > 1.0)
+							nrj = 1.0;
+						energy += nrj;
 					}
 				}
-				if (!shadowed) {
-					double nrj = 0.1 * 1.0 / dlamp / dlamp;
-					if (nrj > 1.0)
-						nrj = 1.0;
-					energy += nrj;
-				}
 			}
-#endif
 			color *= energy;
-#ifdef USE_REFL
-			if (!omin->Hollow()) {
+			if (Refl && !omin->Hollow()) {
 				// reflection
-				double dot = 2 * (v % nv);
+				real dot = 2 * (v % nv);
 				v3 vrefl = v - nv * dot;
 				v3 refl_color = { 0, 0, 0};
-				Trace( depth + 1, vint, vrefl, refl_color);
-				double refl_att = 0.2;
+				Trace<Flash, Refl, Lamp>( depth + 1, vint, vrefl, refl_color);
+				real refl_att = 0.2;
 				color *= (1 - refl_att);
 				color += refl_color * refl_att;
 			}
-#endif
 		}
 	}
+	void Prepare() {
+		if (!m_filled)
+			m_spheres.Clear();
+		m_others.clear();
+		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
+			const CObject *obj = m_objs.at( ii);
+			if (m_filled && Loaded( obj))
+				continue;	// already in the store, straight from the scene file
+			if (obj->Type() == OT_SPHERE) {
+				const CSphere *sph = (const CSphere *)obj;
+				m_spheres.Add( &sph->Center()[0], sph->Radius(), &sph->Color()[0], sph->Hollow(), ii);
+			} else {
+				m_others.push_back( ii);
+			}
+		}
+		m_filled = 0;
+		m_spheres.Build();
+	}
 	void Render( unsigned w = 0, unsigned h = 0, char *fnameout = 0) {
 		if (w && h) {
 			m_w = w;
@@ -558,56 +521,75 @@ public:
 		m_ww = 1;
 		m_hh = m_ww * m_h / m_w;
 		FILE *fout = stdout;
-		unsigned char *bytes = 0;
-		size_t nbytes = 0;
-		if (fnameout) {
+		if (fnameout)
 			fout = fopen( fnameout, "wb");
-			fprintf( fout, "P6\n");
-			nbytes = 3 * h * w;
-			bytes = (unsigned char *)malloc(nbytes);
-		} else {
-			fprintf( fout, "P3\n");
-		}
-		fprintf( fout, "%d %d\n", m_w, m_h);
 		int max = 255;
-		fprintf( fout, "%d\n", max);
+		// P6 to the output file, or P3 to stdout
+		CPnm out( fout, fnameout != 0, m_w, m_h, max);
 
 		// ray
-		v3 v;
-//		printf( "tr=%f\n", tr);
-		for (unsigned jj = 0; jj < m_h; jj++) {
-			v3 vu;
-			vu = m_u * ((double)m_h - (double)jj - 1.0 - (double)m_h / 2) / (double)m_h * m_hh;
-//			vprint( "raycpp vu", vu);
-//			getchar();
-			for (unsigned ii = 0; ii < m_w; ii++) {
-				v3 vr;
-				vr = m_r * ((double)ii - m_w / 2) / m_w * m_ww;
-				v = ~(m_f + vu + vr);
-				v3 color = { 1, 1, 1};
-				Trace( 0, m_e, v, color);
-				if (fnameout) {
-					bytes[(jj * w + ii) * 3 + 0] = max*color[0];
-					bytes[(jj * w + ii) * 3 + 1] = max*color[1];
-					bytes[(jj * w + ii) * 3 + 2] = max*color[2];
-				} else {
-					fprintf( fout, "%2.lf %2.lf %2.lf   ", max*color[0], max*color[1], max*color[2]);
-				}
-			}
-			if (!fnameout) {
-				fprintf( fout, "\n");
-			}
+		Prepare();
+		switch (m_mode) {
+			case FLASH:		Bands<1, 0, 0>( out); break;
+			case REFL:		Bands<0, 1, 0>( out); break;
+			case FLASH | REFL:	Bands<1, 1, 0>( out); break;
+			case LAMP:		Bands<0, 0, 1>( out); break;
+			case FLASH | LAMP:	Bands<1, 0, 1>( out); break;
+			case REFL | LAMP:	Bands<0, 1, 1>( out); break;
+			case FLASH | REFL | LAMP:	Bands<1, 1, 1>( out); break;
+			default:		Bands<0, 0, 0>( out); break;
 		}
-		if (fnameout) {
-			fwrite(bytes, nbytes, 1, fout);
+		out.Flush();
+		if (fnameout)
 			fclose( fout);
-			free(bytes);
-		}
 		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-			delete m_objs.at( ii);
+			if (!Loaded( m_objs.at( ii)))
+				delete m_objs.at( ii);
 			m_objs.at( ii) = 0;
 		}
 	}
+	// rows are traced by bands of PACKET, then streamed out in order
+	template<int Flash, int Refl, int Lamp> void Bands( CPnm& out) const {
+		std::vector<v3> band( PACKET * m_w);
+		for (unsigned j0 = 0; j0 < m_h; j0 += PACKET) {
+			unsigned j1 = j0 + PACKET;
+			if (j1 > m_h)
+				j1 = m_h;
+			for (unsigned i0 = 0; i0 < m_w; i0 += PACKET) {
+				v3 v[PACKET * PACKET];
+				v3 color[PACKET * PACKET];
+				unsigned px[PACKET * PACKET] = { 0}, py[PACKET * PACKET] = { 0};
+				unsigned n = 0;
+				for (unsigned jj = j0; jj < j1; jj++) {
+					v3 vu;
+					vu = m_u * ((double)m_h - (double)jj - 1.0 - (double)m_h / 2) / (double)m_h * m_hh;
+					for (unsigned ii = i0; ii < i0 + PACKET && ii < m_w; ii++) {
+						v3 vr;
+						vr = m_r * ((double)ii - m_w / 2) / m_w * m_ww;
+						v[n] = ~(m_f + vu + vr);
+						color[n] = v3( 1, 1, 1);
+						px[n] = ii;
+						py[n] = jj;
+						n++;
+					}
+				}
+				if (n == 1)
+					Trace<Flash, Refl, Lamp>( 0, m_e, v[0], color[0]);
+				else
+					TracePacket<Flash, Refl, Lamp>( m_e, v, color, n);
+				for (unsigned kk = 0; kk < n; kk++) {
+					band.at( (py[kk] - j0) * m_w + px[kk]) = color[kk];
+				}
+			}
+			for (unsigned jj = j0; jj < j1; jj++) {
+				for (unsigned ii = 0; ii < m_w; ii++) {
+					const v3 &color = band.at( (jj - j0) * m_w + ii);
+					out.Pixel( color[0], color[1], color[2]);
+				}
+				out.EndRow();
+			}
+		}
+	}
 private:
 	unsigned m_w, m_h;	// screen pixel dimensions
 	std::vector<CObject *> m_objs;
@@ -618,12 +600,18 @@ private:
 	v3 m_u;	// up along screen
 	v3 m_r;	// right along screen (computed)
 	double m_ww, m_hh;	// screen dimensions (space)
+	CSpheresT<real> m_spheres;	// SoA copy of the spheres of m_objs
+	std::vector<unsigned> m_others;	// indices of the non-sphere objects of m_objs
+	std::vector<CSphere> m_loaded;	// spheres of a binary scene, in one block (see LoadScene())
+	int m_filled;	// m_spheres already holds the m_loaded spheres (see Prepare())
+	int m_mode;		// lighting mode (FLASH|REFL|LAMP)
 };
 
 int main( int argc, char *argv[]) {
 	unsigned w = 0, h = 0;
 	char *fnameout = 0;
 	char *scene = 0;
+	const char *lighting = 0;
 	int arg = 1;
 	if (arg < argc) {
 		sscanf( argv[arg++], "%d", &w);
@@ -633,11 +621,18 @@ int main( int argc, char *argv[]) {
 				fnameout = argv[arg++];
 				if (arg < argc) {
 					scene = argv[arg++];
+					if (arg < argc) {
+						lighting = argv[arg++];
+					}
 				}
 			}
 		}
 	}
+	if (scene && !strcmp( scene, "-"))
+		scene = 0;	// default scene
 	CRealist r( scene);
+	if (lighting)
+		r.Mode( CRealist::ParseMode( lighting));
 	r.Render( w, h, fnameout);
 	return 0;
 }
@@ -0,0 +1,267 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef RAYCPP_H
+#define RAYCPP_H
+
+#include <math.h>
+
+#include <iostream>
+
+#include "vec.h"
+#include "veccpp.h"
+
+// scene objects of raycpp : its intersection kernels, shared with microbench
+enum { OT_NONE = -1, OT_SPHERE = 0, OT_PLANE, OT_QUAD };
+class CObject {
+public:
+	CObject( int type = OT_NONE, int len = 0) : m_type( type), m_len( len), m_flags( 0), m_hollow(0) {
+	}
+	virtual ~CObject() {
+	}
+	int Type() const {
+		return m_type;
+	}
+	int Len() const {
+		return m_len;
+	}
+	// the m_len serialization parameters (same layout as the constructor ones)
+	virtual void Params( double *params) const = 0;
+	// returns intersection distance (HUGE_VAL => no intersection)
+	virtual real Intersec( const v3& e, const v3& v) const = 0;
+	virtual v3 Normal( const v3& vint) const = 0;
+	// is there any hit along o + t * v (v unit) with 0 < t < dmax ? (no normal nor hit point needed)
+	virtual int Occluded( const v3& o, const v3& v, real dmax) const {
+		real t = Intersec( o, v);
+		return (t > 0) && (t < dmax);
+	}
+	virtual void SetColor( const double *color) {
+		m_color = color;
+	}
+	virtual const v3& Color() const {
+		return m_color;
+	}
+	virtual v3& Center() {
+		return m_c;
+	}
+	virtual const v3& Center() const {
+		return m_c;
+	}
+	virtual void SetHollow( const int& hollow) {
+		m_hollow = hollow;
+	}
+	const int& Hollow() const {
+		return m_hollow;
+	}
+	virtual std::ostream& Serialize( std::ostream& out) const {
+		out << m_type << " " << m_len << std::endl;
+		return out;
+	}
+	friend std::ostream& operator<<( std::ostream& out, const CObject& ob) {
+		return ob.Serialize( out);
+	}
+	virtual void Json( std::ostream& out) const = 0;
+protected:
+	int m_type;
+	int m_len;		// for serialization : total number of double excluding type and len
+//---------------
+	int m_flags;
+	v3 m_color;
+	int m_hollow;
+	v3 m_c;
+};
+
+typedef class CSphere CLamp;
+
+class CSphere : public CObject {
+public:
+	enum {
+		FLAGS, COLOR, COLOR_RED = COLOR, COLOR_GREEN, COLOR_BLUE, CENTER, CENTER_X = CENTER, CENTER_Y, CENTER_Z, RADIUS,
+//		A0, B0, C0, D0, E0, F0,
+		MAX
+	};
+	CSphere( const double *params) :
+		CObject( OT_SPHERE, MAX),
+		m_r( params[RADIUS]) {
+		m_c = &params[CENTER];
+		SetColor( &params[COLOR]);
+//		std::cout << *this << std::endl;
+	}
+	const real& Radius() const {
+		return m_r;
+	}
+	std::ostream& Serialize( std::ostream& out) const {
+		CObject::Serialize( out);
+		out << m_flags << std::endl;
+		out << m_color << std::endl;
+		out << m_c << std::endl;
+		out << m_r << std::endl;
+		return out;
+	}
+	void Params( double *params) const {
+		params[FLAGS] = m_flags;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			params[COLOR + ii] = m_color[ii];
+			params[CENTER + ii] = m_c[ii];
+		}
+		params[RADIUS] = m_r;
+	}
+	void Json( std::ostream& out) const {
+		out << "{'type':'sphere', 'data': [";
+		m_c.Print( out);
+		out << ",\t";
+		out << m_r;
+		out << ",\t";
+		m_color.Print( out);
+		out << "]}";
+	}
+	real Intersec( const v3 &e, const v3 &v) const {
+		real result = HUGE_VAL;
+		real sr2 = m_r * m_r;
+		real a, b, c;
+		v3 t = e - m_c;
+		a = v % v;
+		b = 2 * (v % t);
+		c = (t % t) - sr2;
+		real t1 = 0, t2 = 0;
+		int sol = solvetri( a, b, c, &t1, &t2);
+		if (sol >= 1) {
+			if (sol > 1) {
+				if (t1 < t2) {
+					result = t1;
+				} else {
+					result = t2;
+				}
+			}
+			else {
+				result = t1;
+			}
+		}
+		return result;
+	}
+	// nearest root only, as Intersec : rays leaving the sphere from inside are not blocked
+	int Occluded( const v3& o, const v3& v, real dmax) const {
+		v3 t = o - m_c;
+		real b = v % t;
+		real c = (t % t) - m_r * m_r;
+		if ((c <= 0) || (b > 0))
+			return 0;	// o inside the sphere, or sphere behind o
+		real d = b * b - c;
+		if (d < 0)
+			return 0;
+		real t1 = -b - sqrt( d);
+		return (t1 > 0) && (t1 < dmax);
+	}
+	v3 Normal( const v3& vint) const {
+		v3 nv = ~(vint - Center());
+		return nv;
+	}
+	friend std::ostream& operator<<( std::ostream& out, const CSphere& sp) {
+		out << "sphere: c=";
+		out << sp.Center();
+		out << " r=";
+		out << sp.Radius();
+		out << " col=";
+		out << sp.Color();
+		return out;
+	}
+private:
+	real m_r;
+};
+
+// triangle (loc0, loc1, loc2), or parallelogram (loc0, loc1, loc1 + loc2 - loc0, loc2) when loaded as OT_QUAD
+// the lit side is the one seeing loc0, loc1, loc2 counterclockwise (normal = (loc1 - loc0) ^ (loc2 - loc0))
+class CPlane : public CObject {
+public:
+	enum {
+		FLAGS, COLOR, COLOR_RED = COLOR, COLOR_GREEN, COLOR_BLUE,
+		LOC0, LOC0_X = LOC0, LOC0_Y, LOC0_Z,
+		LOC1, LOC1_X = LOC1, LOC1_Y, LOC1_Z,
+		LOC2, LOC2_X = LOC2, LOC2_Y, LOC2_Z,
+		MAX
+	};
+	CPlane( const double *params, int type = OT_PLANE) :
+		CObject( type, MAX),
+		m_loc0( &params[LOC0]),
+		m_loc1( &params[LOC1]),
+		m_loc2( &params[LOC2])
+	{
+		m_flags = params[FLAGS];
+		SetColor( &params[COLOR]);
+		// everything the intersection needs is known once for all
+		m_e1 = m_loc1 - m_loc0;
+		m_e2 = m_loc2 - m_loc0;
+		m_n = ~(m_e1 ^ m_e2);
+		m_c = m_loc0 + (m_e1 + m_e2) * (type == OT_QUAD ? 0.5 : 1.0 / 3);
+	}
+	std::ostream& Serialize( std::ostream& out) const {
+		CObject::Serialize( out);
+		out << m_flags << std::endl;
+		out << m_color << std::endl;
+		out << m_loc0 << std::endl;
+		out << m_loc1 << std::endl;
+		out << m_loc2 << std::endl;
+		return out;
+	}
+	void Params( double *params) const {
+		params[FLAGS] = m_flags;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			params[COLOR + ii] = m_color[ii];
+			params[LOC0 + ii] = m_loc0[ii];
+			params[LOC1 + ii] = m_loc1[ii];
+			params[LOC2 + ii] = m_loc2[ii];
+		}
+	}
+	void Json( std::ostream& out) const {
+		out << "{'type':'" << (m_type == OT_QUAD ? "quad" : "plane") << "', 'data': [";
+		m_loc0.Print( out);
+		out << ",\t";
+		m_loc1.Print( out);
+		out << ",\t";
+		m_loc2.Print( out);
+		out << ",\t";
+		m_color.Print( out);
+		out << "]}";
+	}
+	// Moller-Trumbore : o + t * v = loc0 + u * e1 + w * e2, solved by Cramer's rule with triple products
+	real Intersec( const v3 &o, const v3 &v) const {
+		v3 p = v ^ m_e2;
+		real det = m_e1 % p;
+		if (fabs( det) < 1e-12)
+			return HUGE_VAL;	// parallel to the surface (or degenerate)
+		real inv = 1 / det;
+		v3 s = o - m_loc0;
+		real u = (s % p) * inv;
+		if ((u < 0) || (u > 1))
+			return HUGE_VAL;
+		v3 q = s ^ m_e1;
+		real w = (v % q) * inv;
+		if ((w < 0) || ((m_type == OT_QUAD ? w : u + w) > 1))
+			return HUGE_VAL;
+		real t = (m_e2 % q) * inv;
+		// rays leaving the surface itself (reflections, shadows) must not hit it again
+		return t > 1e-6 ? t : HUGE_VAL;
+	}
+	v3 Normal( const v3& vint) const {
+		(void)vint;
+		return m_n;
+	}
+	friend std::ostream& operator<<( std::ostream& out, const CPlane& pl) {
+		out << "plane: loc0=";
+		out << pl.m_loc0;
+		out << " loc1=";
+		out << pl.m_loc1;
+		out << " loc2=";
+		out << pl.m_loc2;
+		out << " col=";
+		out << pl.Color();
+		return out;
+	}
+private:
+	v3 m_loc0, m_loc1, m_loc2;
+	v3 m_e1, m_e2;		// edges from loc0
+	v3 m_n;			// unit normal
+};
+
+#endif/*RAYCPP_H*/
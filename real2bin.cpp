@@ -0,0 +1,111 @@
+/*
+ * Copyright(c) 2016-2019 Nicolas Sauzede (nsauzede@laposte.net)
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+// converts a .real text scene to the binary .realb format (see CScene.h)
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "CScene.h"
+
+// the output is removed on any error, so that no truncated scene is left behind
+static int Fail( CScene::CWriter& w, const std::string& out, const char *msg) {
+	printf( "%s\n", msg);
+	w.Abandon();
+	remove( out.c_str());
+	return 1;
+}
+
+// older untyped scene (see CScene::ReadLegacy), objs : stream position past the camera
+static int Legacy( CScene::CWriter& w, std::ifstream& ifs, std::streampos objs, unsigned& nobjs) {
+	ifs.clear();
+	ifs.seekg( objs);
+	std::vector<double> data;
+	int n = CScene::ReadLegacy( ifs, data);
+	if (n <= 0)
+		return -1;
+	for (int ii = 0; ii < n; ii++) {
+		if (w.Add( CScene::SPHERE, CScene::SPHERE_LEN, &data[ii * CScene::SPHERE_LEN]))
+			return -1;
+	}
+	nobjs = n;
+	return 0;
+}
+
+int main( int argc, char *argv[]) {
+	if (argc < 2) {
+		printf( "usage: %s scene.real [scene.realb]\n", argv[0]);
+		return 1;
+	}
+	std::string in = argv[1];
+	std::string out;
+	if (argc > 2) {
+		out = argv[2];
+	} else {
+		out = in;
+		size_t n = out.size();
+		if ((n >= 5) && (out.substr( n - 5) == ".real"))
+			out.resize( n - 5);
+		out += ".realb";
+	}
+	std::ifstream ifs( in.c_str());
+	if (!ifs.is_open()) {
+		printf( "failed to open %s\n", in.c_str());
+		return 1;
+	}
+	// same parsing as CRealist::LoadScene, every record is kept as is; whatever the loader
+	// rejects (a malformed or truncated record, no record at all) is rejected here too
+	// an older untyped scene is written out as typed spheres
+	double cam[9];
+	for (unsigned ii = 0; ii < 9; ii++) {
+		ifs >> cam[ii];
+	}
+	CScene::CWriter w;
+	std::string msg = in + ": not a scene file";
+	if (!ifs)
+		return Fail( w, out, msg.c_str());
+	if (w.Begin( out.c_str(), cam))
+		return Fail( w, out, ("failed to create " + out).c_str());
+	std::streampos objs = ifs.tellg();
+	std::vector<double> data;
+	unsigned nobjs = 0;
+	while (!ifs.eof()) {
+		unsigned type;
+		unsigned len;
+		ifs >> type;
+		if (ifs.eof())
+			break;
+		ifs >> len;
+		if (!ifs && !nobjs) {
+			if (Legacy( w, ifs, objs, nobjs))
+				return Fail( w, out, msg.c_str());
+			break;
+		}
+		if (!ifs)
+			return Fail( w, out, msg.c_str());
+		data.resize( len);
+		for (unsigned ii = 0; ii < len; ii++) {
+			if (ifs.eof())
+				break;
+			ifs >> data[ii];
+		}
+		if (ifs.eof() || !ifs) {
+			char buf[64];
+			snprintf( buf, sizeof( buf), ": malformed or truncated object %u", nobjs + 1);
+			return Fail( w, out, (in + buf).c_str());
+		}
+		if (w.Add( type, len, data.data()))
+			return Fail( w, out, ("failed to write " + out).c_str());
+		nobjs++;
+	}
+	if (!nobjs)
+		return Fail( w, out, (in + ": no object").c_str());
+	if (w.End())
+		return Fail( w, out, ("failed to write " + out).c_str());
+	printf( "%s: %u objects\n", out.c_str(), nobjs);
+	return 0;
+}
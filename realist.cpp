@@ -9,22 +9,44 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <sstream>
+#include <mutex>
+#include <thread>
 
 #include "CSDL.h"
+#include "CPool.h"
+#include "CPnm.h"
+#include "CScene.h"
+#include "CSpheres.h"
+#include "CStats.h"
 
 #include "vec.h"
 #include "veccpp.h"
 
-enum { OT_NONE = -1, OT_SPHERE = 0, OT_PLANE };
+enum { OT_NONE = -1, OT_SPHERE = 0, OT_PLANE, OT_QUAD };
 class CObject {
 public:
 	CObject( int type = OT_NONE, int len = 0) : m_type( type), m_len( len), m_flags( 0), m_hollow(0) {
 	}
 	virtual ~CObject() {
 	}
+	int Type() const {
+		return m_type;
+	}
+	int Len() const {
+		return m_len;
+	}
+	// the m_len serialization parameters (same layout as the constructor ones)
+	virtual void Params( double *params) const = 0;
 	// returns intersection distance (HUGE_VAL => no intersection)
-	virtual double Intersec( const v3& e, const v3& v) const = 0;
+	virtual real Intersec( const v3& e, const v3& v) const = 0;
 	virtual v3 Normal( const v3& vint) const = 0;
+	// is there any hit along o + t * v (v unit) with 0 < t < dmax ? (no normal nor hit point needed)
+	virtual int Occluded( const v3& o, const v3& v, real dmax) const {
+		real t = Intersec( o, v);
+		return (t > 0) && (t < dmax);
+	}
 	virtual void SetColor( const double *color) {
 		m_color = color;
 	}
@@ -32,10 +54,8 @@ public:
 		return m_color;
 	}
 	virtual v3 Color(const v3& pos) const {
-		static v3 foo = pos;
-		foo *= 0;
-		foo += m_color;
-		return foo;
+		(void)pos;
+		return m_color;
 	}
 	virtual v3& Center() {
 		return m_c;
@@ -84,7 +104,7 @@ public:
 		SetColor( &params[COLOR]);
 //		std::cout << *this << std::endl;
 	}
-	const double& Radius() const {
+	const real& Radius() const {
 		return m_r;
 	}
 	virtual const v3& Color() const {
@@ -94,9 +114,9 @@ public:
 		if (!m_flags)
 			return m_color;
 		v3 p = pos - m_c;
-		double rh = !p;
-		double _ph = acos(p[2] / rh);
-		double _th = atan(p[1] / p[0]);
+		real rh = !p;
+		real _ph = acos(p[2] / rh);
+		real _th = atan(p[1] / p[0]);
 		int ph = _ph * 180 / 3.1415;
 		int th = _th * 180 / 3.1415;
 		if (ph < 0)
@@ -120,9 +140,9 @@ public:
 	}
 	virtual v3 ColorCheckboard(const v3& pos) const {
 		v3 p = pos - m_c;
-		double rh = !p;
-		double ph = acos(p[2] / rh) * 180 / 3.1415;
-		double th = atan(p[1] / p[0]) * 180 / 3.1415;
+		real rh = !p;
+		real ph = acos(p[2] / rh) * 180 / 3.1415;
+		real th = atan(p[1] / p[0]) * 180 / 3.1415;
 		if (ph < 0)
 			ph += 360;
 		if (th < 0)
@@ -150,6 +170,14 @@ public:
 		out << m_r << std::endl;
 		return out;
 	}
+	void Params( double *params) const {
+		params[FLAGS] = m_flags;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			params[COLOR + ii] = m_color[ii];
+			params[CENTER + ii] = m_c[ii];
+		}
+		params[RADIUS] = m_r;
+	}
 	void Json( std::ostream& out) const {
 		out << "{'type':'sphere', 'data': [";
 		m_c.Print( out);
@@ -159,15 +187,15 @@ public:
 		m_color.Print( out);
 		out << "]}";
 	}
-	double Intersec( const v3 &e, const v3 &v) const {
-		double result = HUGE_VAL;
-		double sr2 = m_r * m_r;
-		double a, b, c;
+	real Intersec( const v3 &e, const v3 &v) const {
+		real result = HUGE_VAL;
+		real sr2 = m_r * m_r;
+		real a, b, c;
 		v3 t = e - m_c;
 		a = v % v;
 		b = 2 * (v % t);
 		c = (t % t) - sr2;
-		double t1 = 0, t2 = 0;
+		real t1 = 0, t2 = 0;
 		int sol = solvetri( a, b, c, &t1, &t2);
 		if (sol >= 1) {
 			if (sol > 1) {
@@ -183,6 +211,19 @@ public:
 		}
 		return result;
 	}
+	// nearest root only, as Intersec : rays leaving the sphere from inside are not blocked
+	int Occluded( const v3& o, const v3& v, real dmax) const {
+		v3 t = o - m_c;
+		real b = v % t;
+		real c = (t % t) - m_r * m_r;
+		if ((c <= 0) || (b > 0))
+			return 0;	// o inside the sphere, or sphere behind o
+		real d = b * b - c;
+		if (d < 0)
+			return 0;
+		real t1 = -b - sqrt( d);
+		return (t1 > 0) && (t1 < dmax);
+	}
 	v3 Normal( const v3& vint) const {
 		v3 nv = ~(vint - Center());
 		return nv;
@@ -197,9 +238,11 @@ public:
 		return out;
 	}
 private:
-	double m_r;
+	real m_r;
 };
 
+// triangle (loc0, loc1, loc2), or parallelogram (loc0, loc1, loc1 + loc2 - loc0, loc2) when loaded as OT_QUAD
+// the lit side is the one seeing loc0, loc1, loc2 counterclockwise (normal = (loc1 - loc0) ^ (loc2 - loc0))
 class CPlane : public CObject {
 public:
 	enum {
@@ -209,14 +252,19 @@ public:
 		LOC2, LOC2_X = LOC2, LOC2_Y, LOC2_Z,
 		MAX
 	};
-	CPlane( const double *params) :
-		CObject( OT_PLANE, MAX),
+	CPlane( const double *params, int type = OT_PLANE) :
+		CObject( type, MAX),
 		m_loc0( &params[LOC0]),
 		m_loc1( &params[LOC1]),
 		m_loc2( &params[LOC2])
 	{
+		m_flags = params[FLAGS];
 		SetColor( &params[COLOR]);
-		std::cout << *this << std::endl;
+		// everything the intersection needs is known once for all
+		m_e1 = m_loc1 - m_loc0;
+		m_e2 = m_loc2 - m_loc0;
+		m_n = ~(m_e1 ^ m_e2);
+		m_c = m_loc0 + (m_e1 + m_e2) * (type == OT_QUAD ? 0.5 : 1.0 / 3);
 	}
 	std::ostream& Serialize( std::ostream& out) const {
 		CObject::Serialize( out);
@@ -227,8 +275,17 @@ public:
 		out << m_loc2 << std::endl;
 		return out;
 	}
+	void Params( double *params) const {
+		params[FLAGS] = m_flags;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			params[COLOR + ii] = m_color[ii];
+			params[LOC0 + ii] = m_loc0[ii];
+			params[LOC1 + ii] = m_loc1[ii];
+			params[LOC2 + ii] = m_loc2[ii];
+		}
+	}
 	void Json( std::ostream& out) const {
-		out << "'plane': [";
+		out << "{'type':'" << (m_type == OT_QUAD ? "quad" : "plane") << "', 'data': [";
 		m_loc0.Print( out);
 		out << ",\t";
 		m_loc1.Print( out);
@@ -236,68 +293,30 @@ public:
 		m_loc2.Print( out);
 		out << ",\t";
 		m_color.Print( out);
-		out << "]";
-	}
-	double Intersec( const v3 &oi, const v3 &vi) const {
-		double res = HUGE_VAL;
-		v3 n = Normal( m_loc0);
-		v3 p = m_loc0 - oi;
-		double num = p % n;
-		double den = vi % n;
-		if (den == 0) {
-			if (num == 0) {
-				printf( "all intersections\n");
-			}
-			else {
-				printf( "no intersections\n");
-			}
-		}
-		else {
-//			printf( "to be computed\n");
-			double det;
-			double a, b, c, d, e, f, g, h, i;
-			v3 lb = oi + vi;
-			a = oi[0] - lb[0];
-			b = m_loc1[0] - m_loc0[0];
-			c = m_loc2[0] - m_loc0[0];
-			d = oi[1] - lb[1];
-			e = m_loc1[1] - m_loc0[1];
-			f = m_loc2[1] - m_loc0[1];
-			g = oi[2] - lb[2];
-			h = m_loc1[2] - m_loc0[2];
-			i = m_loc2[2] - m_loc0[2];
-			det = a * (e * i - f * h) - b * (i * d - f * g) + c * (d * h - e * g);
-			if (det > 0.001) {	// matrix is invertible
-				double A, B, C, D, E, F, G, H, I;
-				A = (e * i - f * h);
-				B = -(d * i - f * g);
-				C = (d * h - e * g);
-				D = -(b * i - c * h);
-				E = (a * i - c * g);
-				F = -(a * h - b * g);
-				G = (b * f - c * e);
-				H = -(a * f - c * d);
-				I = (a * e - b * d);
-				double t, u = 0, v = 0;
-				// p=p0+u*v1+v*v2
-				t = (A * (oi[0] - m_loc0[0]) + D * (oi[1] - m_loc0[1]) + G * (oi[2] - m_loc0[2])) / det;
-				u = (B * (oi[0] - m_loc0[0]) + E * (oi[1] - m_loc0[1]) + H * (oi[2] - m_loc0[2])) /det;
-				v = (C * (oi[0] - m_loc0[0]) + F * (oi[1] - m_loc0[1]) + I * (oi[2] - m_loc0[2])) / det;
-				if ((u >= 0 && u <= 1) && (v >= 0 && v <= 1) && ((u + v) <= 1)) {
-					if (t > 1) {
-						res = 1;
-					}
-				}
-			}
-		}
-		return res;
+		out << "]}";
+	}
+	// Moller-Trumbore : o + t * v = loc0 + u * e1 + w * e2, solved by Cramer's rule with triple products
+	real Intersec( const v3 &o, const v3 &v) const {
+		v3 p = v ^ m_e2;
+		real det = m_e1 % p;
+		if (fabs( det) < 1e-12)
+			return HUGE_VAL;	// parallel to the surface (or degenerate)
+		real inv = 1 / det;
+		v3 s = o - m_loc0;
+		real u = (s % p) * inv;
+		if ((u < 0) || (u > 1))
+			return HUGE_VAL;
+		v3 q = s ^ m_e1;
+		real w = (v % q) * inv;
+		if ((w < 0) || ((m_type == OT_QUAD ? w : u + w) > 1))
+			return HUGE_VAL;
+		real t = (m_e2 % q) * inv;
+		// rays leaving the surface itself (reflections, shadows) must not hit it again
+		return t > 1e-6 ? t : HUGE_VAL;
 	}
 	v3 Normal( const v3& vint) const {
-		v3 v1 = m_loc1 - vint;
-		v3 v2 = m_loc2 - vint;
-		v3 n;
-		n = ~(v1 ^ v2);
-		return n;
+		(void)vint;
+		return m_n;
 	}
 	friend std::ostream& operator<<( std::ostream& out, const CPlane& pl) {
 		out << "plane: loc0=";
@@ -312,6 +331,8 @@ public:
 	}
 private:
 	v3 m_loc0, m_loc1, m_loc2;
+	v3 m_e1, m_e2;		// edges from loc0
+	v3 m_n;			// unit normal
 };
 
 class CRealist {
@@ -336,7 +357,29 @@ public:
 		out << std::endl << "]" << std::endl;
 		out << "}" << std::endl;
 	}
+	// objects known to the scene files (0 => skipped)
+	static CObject *NewObject( unsigned type, unsigned len, const double *data) {
+		switch (type) {
+			case OT_SPHERE:
+				if (len >= CSphere::MAX)
+					return new CSphere( data);
+				break;
+			case OT_PLANE:
+			case OT_QUAD:
+				if (len >= CPlane::MAX)
+					return new CPlane( data, type);
+				break;
+		}
+		return 0;
+	}
+	// text (.real) or binary (.realb) scene, told apart by the binary magic
 	int LoadScene( const char *scene_file) {
+		CScene bin;
+		int res = bin.Open( scene_file);
+		if (res < 0)
+			return -1;
+		if (!res)
+			return LoadScene( bin);
 		int result = -1;
 		std::ifstream ifs( scene_file);
 		if (!ifs.is_open())
@@ -350,6 +393,8 @@ public:
 		for (unsigned ii = 0; ii < 3; ii++) {
 			ifs >> m_u[ii];
 		}
+		std::streampos objs = ifs.tellg();
+		std::vector<double> data;
 		while (!ifs.eof()) {
 			unsigned type;
 			unsigned len;
@@ -358,29 +403,84 @@ public:
 				break;
 			result = -1;
 			ifs >> len;
+			if (!ifs)
+				break;		// not a scene file, or an older untyped one (see LoadLegacy())
 //			printf( "read type=%u len=%u\n", type, len);
-			double *data = new double[len];
+			data.resize( len);
 			for (unsigned ii = 0; ii < len; ii++) {
 				if (ifs.eof())
 					break;
 				ifs >> data[ii];
 			}
-			if (ifs.eof())
+			if (ifs.eof() || !ifs)
 				break;
-			CObject *obj = 0;
-			switch (type) {
-				case OT_SPHERE:
-					obj = new CSphere( data);
-					break;
-			}
+			CObject *obj = NewObject( type, len, data.data());
 			if (obj)
 				m_objs.push_back( obj);
-			delete data;
 			result = 0;
 		}
+		if (result && m_objs.empty())
+			return LoadLegacy( ifs, objs);
 //		JsonScene( std::cout);
 		return result;
 	}
+	// older untyped text scene (see CScene::ReadLegacy) : its first object did not parse as a typed one
+	int LoadLegacy( std::ifstream& ifs, std::streampos objs) {
+		ifs.clear();
+		ifs.seekg( objs);
+		std::vector<double> data;
+		int n = CScene::ReadLegacy( ifs, data);
+		if (n <= 0)
+			return -1;
+		for (int ii = 0; ii < n; ii++) {
+			m_objs.push_back( NewObject( CScene::SPHERE, CScene::SPHERE_LEN, &data[ii * CScene::SPHERE_LEN]));
+		}
+		return 0;
+	}
+	// the spheres go straight from the mapped parameters to the sphere store (the next Prepare() only
+	// adds the objects created since), and their objects are built in a single block, m_loaded;
+	// the other objects are built one by one
+	int LoadScene( const CScene& bin) {
+		const double *cam = bin.Camera();
+		for (unsigned ii = 0; ii < 3; ii++) {
+			m_e[ii] = cam[ii];
+			m_f[ii] = cam[3 + ii];
+			m_u[ii] = cam[6 + ii];
+		}
+		unsigned nsph = 0;
+		for (const CScene::CRecord *rec = bin.First(); rec; rec = bin.Next( rec)) {
+			if ((rec->type == OT_SPHERE) && (rec->len >= CSphere::MAX))
+				nsph++;
+		}
+		m_loaded.clear();
+		m_loaded.reserve( nsph);	// no reallocation : m_objs points into it
+		m_objs.reserve( m_objs.size() + bin.Objects());
+		m_spheres.Clear();
+		for (const CScene::CRecord *rec = bin.First(); rec; rec = bin.Next( rec)) {
+			const double *params = CScene::Params( rec);
+			if ((rec->type == OT_SPHERE) && (rec->len >= CSphere::MAX)) {
+				real c[3], col[3];
+				for (unsigned ii = 0; ii < 3; ii++) {
+					c[ii] = params[CSphere::CENTER + ii];
+					col[ii] = params[CSphere::COLOR + ii];
+				}
+				m_spheres.Add( c, params[CSphere::RADIUS], col, 0, m_objs.size());
+				m_loaded.push_back( CSphere( params));
+				m_objs.push_back( &m_loaded.back());
+				continue;
+			}
+			CObject *obj = NewObject( rec->type, rec->len, params);
+			if (obj)
+				m_objs.push_back( obj);
+		}
+		m_filled = 1;
+		return 0;
+	}
+	// is obj one of the m_loaded block ? (not to be deleted on its own)
+	int Loaded( const CObject *obj) const {
+		std::less<const CObject *> less;
+		return !m_loaded.empty() && !less( obj, &m_loaded.front()) && less( obj, &m_loaded.back() + 1);
+	}
 	void OutScene( std::ostream& out) const {
 		out << m_e << std::endl;
 		out << m_f << std::endl;
@@ -390,16 +490,45 @@ public:
 			out << *(m_objs.at( ii)) << std::endl;
 		}
 	}
+	// binary if the file name ends with .realb, text otherwise
 	int SaveScene( const char *scene_file) const {
+		size_t n = strlen( scene_file);
+		if ((n >= 6) && !strcmp( scene_file + n - 6, ".realb"))
+			return SaveBinScene( scene_file);
 		std::ofstream f( scene_file);
 		OutScene( f);
 		return 0;
 	}
+	int SaveBinScene( const char *scene_file) const {
+		CScene::CWriter out;
+		double cam[9];
+		for (unsigned ii = 0; ii < 3; ii++) {
+			cam[ii] = m_e[ii];
+			cam[3 + ii] = m_f[ii];
+			cam[6 + ii] = m_u[ii];
+		}
+		if (out.Begin( scene_file, cam))
+			return -1;
+		std::vector<double> params;
+		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
+			const CObject *obj = m_objs.at( ii);
+			params.resize( obj->Len());
+			obj->Params( &params[0]);
+			if (out.Add( obj->Type(), obj->Len(), &params[0]))
+				return -1;
+		}
+		return out.End();
+	}
 #define W 1024
 #define H 768
 	CRealist( const char *scene_file = 0):
 		m_w(W),
-		m_h(H) {
+		m_h(H),
+		m_pool(0),
+		m_filled(0),
+		m_mode(DefaultMode()),
+		m_aa(1),
+		m_prefix(0) {
 //		std::cout << "# initial #objects: " << m_objs.size() << std::endl;
 		const char *wfile_name = 0;
 		if (scene_file) {
@@ -459,11 +588,7 @@ public:
 			}
 		}
 		if (m_r[0] == 0 && m_r[1] == 0 && m_r[2] == 0) {
-			m_u = ~m_u;
-			m_r = m_f ^ m_u;		// compute right
-			m_u = m_r ^ m_f;		// re-compute up
-			m_u = ~m_u;
-			m_r = ~m_r;
+			Orient();
 		}
 
 //		vprint( "#e", m_e);
@@ -492,257 +617,792 @@ public:
 			SaveScene( wfile_name);
 		}
 	}
+	// right and up unit vectors, orthogonal to front (to be called whenever m_f or m_u changed)
+	void Orient() {
+		m_u = ~m_u;
+		m_r = m_f ^ m_u;		// compute right
+		m_u = m_r ^ m_f;		// re-compute up
+		m_u = ~m_u;
+		m_r = ~m_r;
+	}
+	// camera path keyframe (see LoadPath())
+	struct CKey {
+		unsigned frame;
+		v3 e, f, u;	// camera, as m_e, m_f, m_u
+		v3 lamp;	// m_lamps[0] center
+	};
+	// camera path for Batch() : one keyframe per line, frame e(3) f(3) u(3) [lamp(3)],
+	// in increasing frame order ('#' starts a comment line); keyframes without a lamp keep the
+	// previous one (the scene one at first), frames in between are linearly interpolated
+	int LoadPath( const char *path_file) {
+		std::ifstream ifs( path_file);
+		if (!ifs.is_open())
+			return -1;
+		m_keys.clear();
+		v3 lamp = m_lamps.at( 0)->Center();
+		std::string line;
+		while (std::getline( ifs, line)) {
+			std::istringstream iss( line);
+			CKey key;
+			if (!(iss >> key.frame)) {
+				iss.clear();
+				char c = 0;
+				if ((iss >> c) && (c != '#'))
+					return -1;
+				continue;	// blank or comment
+			}
+			v3 *vecs[] = { &key.e, &key.f, &key.u};
+			for (unsigned ii = 0; ii < 3; ii++) {
+				for (unsigned jj = 0; jj < 3; jj++) {
+					iss >> (*vecs[ii])[jj];
+				}
+			}
+			if (!iss)
+				return -1;
+			v3 l;
+			if (iss >> l[0] >> l[1] >> l[2])
+				lamp = l;
+			key.lamp = lamp;
+			if (m_keys.size() && (key.frame <= m_keys.back().frame))
+				return -1;
+			m_keys.push_back( key);
+		}
+		if (m_keys.empty())
+			return -1;
+		return 0;
+	}
+	// output images of Batch() : prefix0000.ppm, prefix0001.ppm, ...
+	void Prefix( const char *prefix) {
+		m_prefix = prefix;
+	}
+	// camera and lamp of frame (between the first and last keyframes)
+	void Key( unsigned frame) {
+		unsigned k = 0;
+		while (k + 1 < m_keys.size() && m_keys.at( k + 1).frame <= frame)
+			k++;
+		const CKey& a = m_keys.at( k);
+		const CKey& b = k + 1 < m_keys.size() ? m_keys.at( k + 1) : a;
+		double t = b.frame > a.frame ? (double)(frame - a.frame) / (b.frame - a.frame) : 0;
+		m_e = a.e + (b.e - a.e) * t;
+		m_f = a.f + (b.f - a.f) * t;
+		m_u = a.u + (b.u - a.u) * t;
+		Orient();
+		m_lamps.at( 0)->Center() = a.lamp + (b.lamp - a.lamp) * t;
+	}
 #define MAX_DEPTH 3
-	void Trace( int depth, const v3 &o, const v3 &v, v3 &color) const {
+#ifndef PACKET
+#define PACKET 2		// primary rays are traced by PACKET x PACKET packets (1 => one by one)
+#endif
+	// lighting modes (or'ed together), selected at run time : each combination has its own
+	// Trace<Flash, Refl, Lamp> instantiation, picked once per frame
+	enum { FLASH = 1, REFL = 2, LAMP = 4, MODES = 8 };
+	// default mode, as set by the USE_FLASH/USE_REFL/USE_LAMP build flags
+	static int DefaultMode() {
+		int mode = 0;
+#ifdef USE_FLASH
+		mode |= FLASH;
+#endif
+#ifdef USE_REFL
+		mode |= REFL;
+#endif
+#ifdef USE_LAMP
+		mode |= LAMP;
+#endif
+		return mode;
+	}
+	// letters f (flash), r (reflections), l (lamps), anything else (eg: "-") => none
+	static int ParseMode( const char *s) {
+		int mode = 0;
+		for (; *s; s++) {
+			if (*s == 'f')
+				mode |= FLASH;
+			else if (*s == 'r')
+				mode |= REFL;
+			else if (*s == 'l')
+				mode |= LAMP;
+		}
+		return mode;
+	}
+	static void PrintMode( int mode) {
+		printf( "lighting:%s%s%s%s\n", mode & FLASH ? " flash" : "", mode & REFL ? " refl" : "", mode & LAMP ? " lamp" : "", mode ? "" : " ambient");
+	}
+	int Mode() const {
+		return m_mode;
+	}
+	void Mode( int mode) {
+		m_mode = mode & (MODES - 1);
+	}
+	// lamp aperture : bounds of the lamp images (lamp + (lamp - hit point)) seen over a whole frame
+	struct CAperture {
+		double lo[3], hi[3];
+		void Clear() {
+			for (unsigned ii = 0; ii < 3; ii++) {
+				lo[ii] = 10000;
+				hi[ii] = -10000;
+			}
+		}
+		void Add( const v3& p) {
+			for (unsigned ii = 0; ii < 3; ii++) {
+				if (p[ii] < lo[ii]) lo[ii] = p[ii];
+				if (p[ii] > hi[ii]) hi[ii] = p[ii];
+			}
+		}
+		void Merge( const CAperture& a) {
+			for (unsigned ii = 0; ii < 3; ii++) {
+				if (a.lo[ii] < lo[ii]) lo[ii] = a.lo[ii];
+				if (a.hi[ii] > hi[ii]) hi[ii] = a.hi[ii];
+			}
+		}
+		// strictly inside, away from the borders (y uses the x margin, as it always did)
+		int Inside( const v3& p) const {
+			double xdelt = (hi[0] - lo[0]) / 2.8;
+			double zdelt = (hi[2] - lo[2]) / 114.8;
+			return (p[0] > lo[0] + xdelt) && (p[0] < hi[0] - xdelt) &&
+				(p[1] > lo[1] + xdelt) && (p[1] < hi[1] - xdelt) &&
+				(p[2] > lo[2] + zdelt) && (p[2] < hi[2] - zdelt);
+		}
+	};
+	// shading context of a frame : computed by Frame() before rendering, read-only while rendering
+	struct CFrame {
+		int mode;		// lighting mode of the frame
+		unsigned aa;		// anti-aliasing grid (1 => off)
+		int primary;		// primary hits : TRACE, RECORD or RELIGHT
+		CAperture aperture;	// LAMP only
+	};
+	// primary hits of a frame : traced, traced and recorded into the G-buffer, or taken from the
+	// G-buffer (only the lamps moved since it was recorded : the lighting stage is all that is left)
+	enum { TRACE, RECORD, RELIGHT };
+	// G-buffer entry : the hit of a ray, as left by the geometry stage of the shading (see Surface())
+	struct CHit {
+		unsigned imin;	// hit object (CSpheres::NONE => none)
+		real t;	// hit distance (HUGE_VAL => none)
+		v3 vint;	// hit point (lighting modes only)
+		v3 nv;		// unit normal (lighting modes only)
+		v3 color;	// base color
+	};
+	// primary ray through pixel (ii, jj) (jj counted from the bottom, fractions for sub-pixel samples)
+	v3 Ray( double ii, double jj) const {
+		v3 vu = m_u * (jj - m_h / 2) / m_h * m_hh;
+		v3 vr = m_r * (ii - m_w / 2) / m_w * m_ww;
+		return ~(m_f + vu + vr);
+	}
+	// to be called whenever the camera, objects or lighting mode changed, before rendering the frame
+	// RELIGHT is valid only if a complete RECORD frame was rendered since the camera, the lighting
+	// mode or any object but the lamps last changed
+	// the lamp aperture depends on the camera, the objects and the lamps of this frame only : it is
+	// gathered by a coarse geometry pre-pass (see Aperture()), not by a full resolution one
+	void Frame( int primary = TRACE) {
+		STAT_PHASE( m_stats, FRAME);
+		m_frame.mode = m_mode;
+		m_frame.aa = m_aa;
+		m_frame.primary = primary;
+		if (m_frame.aa > 1) {
+			m_ids.resize( m_w * m_h);
+			m_edges.resize( m_w * m_h);
+		}
+		if (primary != TRACE)
+			m_gbuf.resize( m_w * m_h);
+		if (m_frame.mode & LAMP)
+			Aperture( m_frame.aperture);
+	}
+#define APERTURE_STEP 8		// one ray per APERTURE_STEP x APERTURE_STEP block in the aperture pre-pass
+	// geometry pre-pass : the lamp images of one primary ray per APERTURE_STEP block, into ap
+	void Aperture( CAperture& ap) const {
+		std::mutex mutex;
+		int refl = m_frame.mode & REFL;
+		ap.Clear();
+		auto tile = [this, &mutex, &ap, refl]( unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+			CAperture local;
+			local.Clear();
+			for (unsigned jj = (y0 + APERTURE_STEP - 1) / APERTURE_STEP * APERTURE_STEP; jj < y1; jj += APERTURE_STEP) {
+				for (unsigned ii = (x0 + APERTURE_STEP - 1) / APERTURE_STEP * APERTURE_STEP; ii < x1; ii += APERTURE_STEP) {
+					if (refl)
+						Aperture<1>( 0, m_e, Ray( ii, jj), local);
+					else
+						Aperture<0>( 0, m_e, Ray( ii, jj), local);
+				}
+			}
+			STAT_GATHER( m_stats);
+			std::lock_guard<std::mutex> lock( mutex);
+			ap.Merge( local);
+		};
+		if (m_pool)
+			m_pool->Run( m_w, m_h, tile);
+		else
+			tile( 0, 0, m_w, m_h);
+	}
+	// follows the ray as Trace would (geometry only), adding the lamp images of its hit points to ap
+	template<int Refl> void Aperture( int depth, const v3 &o, const v3 &v, CAperture& ap) const {
 		if (depth > MAX_DEPTH)
 			return;
-		double tmin = HUGE_VAL;
-		CObject *omin = 0;
-		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-			double tres = m_objs.at( ii)->Intersec( o, v);
-			if ((tres > 0) && (tres < tmin)) {
+		STAT( APERTURE, 1);
+		real tmin = HUGE_VAL;
+		unsigned imin = CSpheres::NONE;
+		unsigned kmin = m_spheres.Closest( &o[0], &v[0], tmin, imin);
+		Others( o, v, tmin, imin, kmin);
+		if (imin == CSpheres::NONE)
+			return;
+		const CObject *omin = m_objs.at( imin);
+		v3 vint = o + v * tmin;
+		for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
+			if (omin == m_lamps.at( jj))
+				continue;
+			v3 plamp = m_lamps.at( jj)->Center();
+			v3 vlamp = plamp - vint;
+			ap.Add( plamp + vlamp);
+		}
+		if (Refl && !omin->Hollow()) {
+			v3 nv = ~omin->Normal( vint);
+			real dot = 2 * (v % nv);
+			Aperture<Refl>( depth + 1, vint, v - nv * dot, ap);
+		}
+	}
+	// may the primary ray v meet a lamp before the G-buffer entry hit (or was hit a lamp) ?
+	// the lamps are the only objects moving without a RECORD frame, other hits stay valid
+	// (conservative : rays passing close to a lamp are traced again)
+	int LampFirst( const v3 &v, const CHit &hit) const {
+		for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
+			const CLamp *lamp = m_lamps.at( jj);
+			if ((hit.imin != CSpheres::NONE) && (m_objs.at( hit.imin) == lamp))
+				return 1;
+			v3 c = lamp->Center() - m_e;
+			real tc = c % v;
+			real r = lamp->Radius() * (1 + (sizeof( real) < sizeof( double) ? 1e-3 : 1e-6)) + 1e-9;
+			if (((c % c) - tc * tc <= r * r) && (tc + r > 0) && (tc - r < hit.t))
+				return 1;
+		}
+		return 0;
+	}
+	template<int Flash, int Refl, int Lamp> void Trace( int depth, const v3 &o, const v3 &v, v3 &color) const {
+		if (depth > MAX_DEPTH)
+			return;
+		real tmin = HUGE_VAL;
+		unsigned imin = CSpheres::NONE;
+		// spheres are batched in the SoA store, other primitives go through the virtual path
+		unsigned kmin = m_spheres.Closest( &o[0], &v[0], tmin, imin);
+		Others( o, v, tmin, imin, kmin);
+		Shade<Flash, Refl, Lamp>( depth, o, v, tmin, imin, kmin, color);
+	}
+	// traces n (<= PACKET * PACKET) rays of common origin o : spheres are tested for the whole packet
+	// at once, then each ray is shaded on its own (rays missing everything are just cleared)
+	// the primary hit objects (NONE => background) go to ids, and their G-buffer entries to hits, when given
+	template<int Flash, int Refl, int Lamp> void TracePacket( const v3 &o, const v3 *v, v3 *color, unsigned n, unsigned *ids = 0, CHit *hits = 0) const {
+		real tmin[PACKET * PACKET];
+		unsigned imin[PACKET * PACKET];
+		unsigned kmin[PACKET * PACKET];
+		for (unsigned ii = 0; ii < n; ii++) {
+			tmin[ii] = HUGE_VAL;
+			imin[ii] = kmin[ii] = CSpheres::NONE;
+		}
+		m_spheres.ClosestPacket( &o[0], &v[0][0], n, tmin, imin, kmin);
+		for (unsigned ii = 0; ii < n; ii++) {
+			Others( o, v[ii], tmin[ii], imin[ii], kmin[ii]);
+			if (ids)
+				ids[ii] = imin[ii];
+			if (hits)
+				Surface<Flash || Refl || Lamp>( o, v[ii], tmin[ii], imin[ii], kmin[ii], hits[ii]);
+			if (imin[ii] == CSpheres::NONE) {
+				color[ii] *= 0;
+				continue;
+			}
+			if (hits)
+				Light<Flash, Refl, Lamp>( 0, v[ii], hits[ii], color[ii]);
+			else
+				Shade<Flash, Refl, Lamp>( 0, o, v[ii], tmin[ii], imin[ii], kmin[ii], color[ii]);
+		}
+	}
+	// non-sphere objects, closer than the current hit (ties go to the lowest object index,
+	// as a plain scan of m_objs would do)
+	void Others( const v3 &o, const v3 &v, real& tmin, unsigned& imin, unsigned& kmin) const {
+		STAT( TESTS, m_others.size());
+		for (unsigned jj = 0; jj < m_others.size(); jj++) {
+			unsigned ii = m_others.at( jj);
+			real tres = m_objs.at( ii)->Intersec( o, v);
+			if ((tres > 0) && (tres < HUGE_VAL) && ((tres < tmin) || ((tres == tmin) && (ii < imin)))) {
 				tmin = tres;
-				omin = m_objs.at( ii);
+				imin = ii;
+				kmin = CSpheres::NONE;
 			}
 		}
-		double def_color = 0;
-		color *= def_color;
-		if (tmin < HUGE_VAL) {
-			double energy = 0;
-			// ambient
-#if defined USE_FLASH || defined USE_REFL || defined USE_LAMP
-			energy += 0.2;
-			v3 vint;
-			v3 nv;
-#else
-			energy += 1.0;
-#endif
-#if defined USE_FLASH || defined USE_REFL || defined USE_LAMP
+	}
+	// is the segment from o along unit direction v blocked by some opaque object (but skip) before dmax ?
+	// hollow objects (lamps) never block
+	int Occluded( const v3 &o, const v3 &v, real dmax, unsigned skip) const {
+		if (m_spheres.Occluded( &o[0], &v[0], dmax, skip))
+			return 1;
+		for (unsigned jj = 0; jj < m_others.size(); jj++) {
+			unsigned ii = m_others.at( jj);
+			const CObject *obj = m_objs.at( ii);
+			if ((ii == skip) || obj->Hollow())
+				continue;
+			STAT( TESTS, 1);
+			if (obj->Occluded( o, v, dmax))
+				return 1;
+		}
+		return 0;
+	}
+	// color of the ray o + t * v hitting object imin (sphere store slot kmin) at tmin
+	// the lighting tests are compile-time constants : disabled modes cost nothing
+	template<int Flash, int Refl, int Lamp> void Shade( int depth, const v3 &o, const v3 &v, real tmin, unsigned imin, unsigned kmin, v3 &color) const {
+		CHit hit;
+		Surface<Flash || Refl || Lamp>( o, v, tmin, imin, kmin, hit);
+		Light<Flash, Refl, Lamp>( depth, v, hit, color);
+	}
+	// geometry stage of Shade : what the lighting needs to know of the hit (Lit => any lighting mode)
+	template<int Lit> void Surface( const v3 &o, const v3 &v, real tmin, unsigned imin, unsigned kmin, CHit &hit) const {
+		hit.imin = imin;
+		hit.t = tmin;
+		if (tmin == HUGE_VAL)
+			return;
+		CObject *omin = m_objs.at( imin);
+		if (Lit) {
 			// coords of intersec
-			vint = o + v * tmin;
+			hit.vint = o + v * tmin;
 			// normal at intersec
-			nv = ~omin->Normal( vint);
-			// intersected object color
-			color = omin->Color(vint) * 1.0;
-#else
+			hit.nv = ~omin->Normal( hit.vint);
+			// intersected object color (may be textured : ask the object itself)
+			hit.color = omin->Color(hit.vint) * 1.0;
+		} else {
 			// intersected object color
-			color = omin->Color() * 1.0;
-#endif
-#ifdef USE_FLASH
-			// camera flash
+			if (kmin != CSpheres::NONE) {
+				real col[3];
+				m_spheres.Color( kmin, col);
+				hit.color = v3( col) * 1.0;
+			} else {
+				hit.color = omin->Color() * 1.0;
+			}
+		}
+	}
+	// lighting stage of Shade : color of the ray v reaching hit
+	template<int Flash, int Refl, int Lamp> void Light( int depth, const v3 &v, const CHit &hit, v3 &color) const {
+		real def_color = 0;
+		color *= def_color;
+		if (hit.t < HUGE_VAL) {
+			unsigned imin = hit.imin;
+			const CObject *omin = m_objs.at( imin);
+			const v3 &vint = hit.vint;
+			const v3 &nv = hit.nv;
+			real energy = 0;
+			if (Flash || Refl || Lamp) {
+				// ambient
+				energy += 0.2;
+			} else {
+				// ambient
+				energy += 1.0;
+			}
+			color = hit.color;
+			if (Flash) {
+				// camera flash
 #define MAX_FLASH 0.1
-			double flash_nrj = 1 - energy;
-			if (flash_nrj > MAX_FLASH)
-				flash_nrj = MAX_FLASH;
-			double dist = !(vint - m_e);
+				real flash_nrj = 1 - energy;
+				if (flash_nrj > MAX_FLASH)
+					flash_nrj = MAX_FLASH;
+				real dist = !(vint - m_e);
 #define LAMP_FLOOR 0.4
-			if (dist < LAMP_FLOOR)
-				dist = LAMP_FLOOR;
-			energy += flash_nrj / dist / dist;
-#endif
-#ifdef USE_LAMP
-			// is there any object intersection between vint and a lamp ?
-			for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
-				if (omin == m_lamps.at( jj)) // skip current lamp==intersected object
-					continue;
-				v3 plamp = m_lamps.at( jj)->Center();
-				v3 vlamp = plamp - vint;
-//				vprint("plamp", plamp);
-//				vprint("vlamp", vlamp);
-//				vprint("poslamp", plamp + vlamp);
-				v3 poslamp = plamp + vlamp;
-				static double posxlampmin = 10000;
-				static double posxlampmax = -10000;
-				if (poslamp[0] < posxlampmin) posxlampmin = poslamp[0];
-				if (poslamp[0] > posxlampmax) posxlampmax = poslamp[0];
-//				printf("posxlampmin=%f posxlampmax=%f\n", posxlampmin, posxlampmax);
-				static double posylampmin = 10000;
-				static double posylampmax = -10000;
-				if (poslamp[1] < posylampmin) posylampmin = poslamp[1];
-				if (poslamp[1] > posylampmax) posylampmax = poslamp[1];
-//				printf("posylampmin=%f posylampmax=%f\n", posylampmin, posylampmax);
-				static double poszlampmin = 10000;
-				static double poszlampmax = -10000;
-				if (poslamp[2] < poszlampmin) poszlampmin = poslamp[2];
-				if (poslamp[2] > poszlampmax) poszlampmax = poslamp[2];
-//				printf("poszlampmin=%f poszlampmax=%f\n", poszlampmin, poszlampmax);
-				// test if lamp intersection is in the aperture
-#if 1
-/*
-posxlampmin= -0.445822 posxlampmax= 0.396050
-posylampmin= -1.366719 posylampmax= -0.694907
-poszlampmin= 0.700000 poszlampmax= 1.046431
-*/
-#if 0
-#define POSXLAMPMIN -0.445822
-#define POSXLAMPMAX 0.396050
-#define POSYLAMPMIN -1.366719
-#define POSYLAMPMAX -0.694907
-#define POSZLAMPMIN 0.700000
-#define POSZLAMPMAX 1.046431
-#else
-#define POSXLAMPMIN posxlampmin
-#define POSXLAMPMAX posxlampmax
-#define POSYLAMPMIN posylampmin
-#define POSYLAMPMAX posylampmax
-#define POSZLAMPMIN poszlampmin
-#define POSZLAMPMAX poszlampmax
-#endif
-//#define POSDELT 0*10.01
-#define POSXDELT ((POSXLAMPMAX - POSXLAMPMIN) / 2.8)
-#define POSYDELT ((POSYLAMPMAX - POSYLAMPMIN) / 112.9)
-#define POSZDELT ((POSZLAMPMAX - POSZLAMPMIN) / 114.8)
-#define POSXMIN (POSXLAMPMIN + POSXDELT)
-#define POSXMAX (POSXLAMPMAX - POSXDELT)
-#define POSYMIN (POSYLAMPMIN + POSXDELT)
-#define POSYMAX (POSYLAMPMAX - POSXDELT)
-#define POSZMIN (POSZLAMPMIN + POSZDELT)
-#define POSZMAX (POSZLAMPMAX - POSZDELT)
-				if (!(
-				(poslamp[0] > POSXMIN) && (poslamp[0] < POSXMAX) &&
-				(poslamp[1] > POSYMIN) && (poslamp[1] < POSYMAX) &&
-				(poslamp[2] > POSZMIN) && (poslamp[2] < POSZMAX)
-				)) {
-					continue;
-				}
-#else
-#endif
-				// is normal dot vlamp <= 0 (surface not exposed to light)
-				if ((vlamp % nv) <= 0)
-					continue;
-				double dlamp = !vlamp;
-				int shadowed = 0;
-				for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-					if (omin == m_objs.at( ii)) // skip current object=intersected object
+				if (dist < LAMP_FLOOR)
+					dist = LAMP_FLOOR;
+				energy += flash_nrj / dist / dist;
+			}
+			if (Lamp) {
+				// is there any object intersection between vint and a lamp ?
+				for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
+					if (omin == m_lamps.at( jj)) // skip current lamp==intersected object
 						continue;
-					double tres = m_objs.at( ii)->Intersec( vint, vlamp);
-					if ((tres > 0) && (tres < tmin)) {
-						v3 vint2 = vint + vlamp * tres;
-						double dint = !(vint2 - vint);
-						if ((dint < dlamp) && !m_objs.at( ii)->Hollow()) {
-							shadowed = 1;
-							break;
-						}
+					v3 plamp = m_lamps.at( jj)->Center();
+					v3 vlamp = plamp - vint;
+//					vprint("plamp", plamp);
+//					vprint("vlamp", vlamp);
+//					vprint("poslamp", plamp + vlamp);
+					v3 poslamp = plamp + vlamp;
+					// test if lamp intersection is in the aperture
+					if (!m_frame.aperture.Inside( poslamp))
+						continue;
+					// is normal dot vlamp <= 0 (surface not exposed to light)
+					if ((vlamp % nv) <= 0)
+						continue;
+					real dlamp = !vlamp;
+					STAT( SHADOW, 1);
+					int shadowed = Occluded( vint, vlamp / dlamp, dlamp, imin);
+					if (!shadowed) {
+						real nrj = 0.1 * 1.0 / dlamp / dlamp;
+						if (nrj > 1.0)
+							nrj = 1.0;
+						energy += nrj;
 					}
 				}
-				if (!shadowed) {
-					double nrj = 0.1 * 1.0 / dlamp / dlamp;
-					if (nrj > 1.0)
-						nrj = 1.0;
-					energy += nrj;
-				}
 			}
-#endif
 			color *= energy;
-#ifdef USE_REFL
-			if (!omin->Hollow()) {
+			if (Refl && !omin->Hollow()) {
 				// reflection
-				double dot = 2 * (v % nv);
+				real dot = 2 * (v % nv);
 				v3 vrefl = v - nv * dot;
 				v3 refl_color = { 0, 0, 0};
-				Trace( depth + 1, vint, vrefl, refl_color);
-				double refl_att = 0.2;
+				STAT( REFLECTED, 1);
+				Trace<Flash, Refl, Lamp>( depth + 1, vint, vrefl, refl_color);
+				real refl_att = 0.2;
 				color *= (1 - refl_att);
 				color += refl_color * refl_att;
 			}
-#endif
 		}
 	}
-	void Render( /*const double &tr = 0*/) const {
-		// ray
-		v3 v;
+	// (re)builds the sphere store and its hierarchy (planes stay in m_others); to be called whenever objects
+	// but the lamps moved : the lamps stay in m_others too, tested where they stand, so that moving them
+	// needs no rebuild
+	void Prepare() {
+		STAT_PHASE( m_stats, PREPARE);
+		if (!m_filled)
+			m_spheres.Clear();
+		m_others.clear();
+		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
+			const CObject *obj = m_objs.at( ii);
+			if (m_filled && Loaded( obj))
+				continue;	// already in the store, straight from the scene file
+			if ((obj->Type() == OT_SPHERE) && !Lamp( obj)) {
+				const CSphere *sph = (const CSphere *)obj;
+				m_spheres.Add( &sph->Center()[0], sph->Radius(), &sph->Color()[0], sph->Hollow(), ii);
+			} else {
+				m_others.push_back( ii);
+			}
+		}
+		m_filled = 0;
+		m_spheres.Build();
+	}
+	int Lamp( const CObject *obj) const {
+		for (unsigned jj = 0; jj < m_lamps.size(); jj++) {
+			if (obj == m_lamps.at( jj))
+				return 1;
+		}
+		return 0;
+	}
+	// renders rows [y0,y1[ (y1 == 0 => m_h) tracing one ray per step x step block, upscaled into m_arr
+	// pixels already traced by a previous coarser pass of step done are kept as is
+	void Render( unsigned step = 1, unsigned done = 0, unsigned y0 = 0, unsigned y1 = 0) const {
+		if (!y1)
+			y1 = m_h;
+		STAT_PHASE( m_stats, RENDER);
+		Tiler tiler = RenderTiler( m_frame.mode);
+		if (m_pool) {
+			m_pool->Run( m_w, y1 - y0, [this, tiler, y0, step, done]( unsigned tx0, unsigned ty0, unsigned tx1, unsigned ty1) {
+				(this->*tiler)( tx0, y0 + ty0, tx1, y0 + ty1, step, done);
+			});
+		} else {
+			(this->*tiler)( 0, y0, m_w, y1, step, done);
+		}
+	}
+	typedef void (CRealist::*Tiler)( unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned step, unsigned done) const;
+	// RenderTile instantiation of a lighting mode
+	static Tiler RenderTiler( int mode) {
+		switch (mode) {
+			case FLASH:		return &CRealist::RenderTile<1, 0, 0>;
+			case REFL:		return &CRealist::RenderTile<0, 1, 0>;
+			case FLASH | REFL:	return &CRealist::RenderTile<1, 1, 0>;
+			case LAMP:		return &CRealist::RenderTile<0, 0, 1>;
+			case FLASH | LAMP:	return &CRealist::RenderTile<1, 0, 1>;
+			case REFL | LAMP:	return &CRealist::RenderTile<0, 1, 1>;
+			case FLASH | REFL | LAMP:	return &CRealist::RenderTile<1, 1, 1>;
+			default:		return &CRealist::RenderTile<0, 0, 0>;
+		}
+	}
+	// renders pixels [x0,x1[ x [y0,y1[ into m_arr (y counted from the bottom)
+	template<int Flash, int Refl, int Lamp> void RenderTile( unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned step = 1, unsigned done = 0) const {
+		// rays of up to PACKET x PACKET neighbour blocks are traced together
+		unsigned pstep = step * PACKET;
+		unsigned px[PACKET * PACKET] = { 0}, py[PACKET * PACKET] = { 0};
+		v3 v[PACKET * PACKET];
+		v3 color[PACKET * PACKET];
+		unsigned id[PACKET * PACKET];
+		unsigned *ids = m_frame.aa > 1 ? id : 0;	// hit objects, for the anti-aliasing edges
+		CHit hit[PACKET * PACKET];
+		CHit *hits = m_frame.primary == RECORD ? hit : 0;	// G-buffer entries
 //		printf( "tr=%f\n", tr);
-		for (unsigned jj = 0; jj < m_h; jj++) {
-			v3 vu;
-			vu = m_u * ((double)jj - m_h / 2) / m_h * m_hh;
-			for (unsigned ii = 0; ii < m_w; ii++) {
-				v3 vr;
-				vr = m_r * ((double)ii - m_w / 2) / m_w * m_ww;
-				v = ~(m_f + vu + vr);
-				v3 color = { 1, 1, 1};
-				Trace( 0, m_e, v, color);
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 0] = color[0];
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 1] = color[1];
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 2] = color[2];
-			}
-//			printf( "\n");
-		}
-	}
-	// DoF (depth of field), aka focal blur, tentative; use 3x3=9 rays instead of only one
-	void Render2( /*const double &tr = 0*/) const {
-		for (unsigned jj = 0; jj < m_h; jj++) {
-			v3 vu[3];
-			vu[0] = m_u * ((double)jj - 1 - m_h / 2) / m_h * m_hh;
-			vu[1] = m_u * ((double)jj + 0 - m_h / 2) / m_h * m_hh;
-			vu[2] = m_u * ((double)jj + 1 - m_h / 2) / m_h * m_hh;
+		for (unsigned jb = (y0 + step - 1) / step * step; jb < y1; jb += pstep) {
+			for (unsigned ib = (x0 + step - 1) / step * step; ib < x1; ib += pstep) {
+				unsigned n = 0;
+				for (unsigned jj = jb; jj < jb + pstep && jj < y1; jj += step) {
+					for (unsigned ii = ib; ii < ib + pstep && ii < x1; ii += step) {
+						if (done && !(ii % done) && !(jj % done))
+							continue;	// already traced, its (smaller) block is already filled
+						v[n] = Ray( ii, jj);
+						color[n] = v3( 1, 1, 1);
+						px[n] = ii;
+						py[n] = jj;
+						n++;
+					}
+				}
+				if (m_frame.primary == RELIGHT) {
+					// G-buffer hits are lit again, unless a lamp may now be in the way
+					for (unsigned kk = 0; kk < n; kk++) {
+						CHit &cached = m_gbuf[(m_h - py[kk] - 1) * m_w + px[kk]];
+						if (LampFirst( v[kk], cached)) {
+							STAT( PRIMARY, 1);
+							TracePacket<Flash, Refl, Lamp>( m_e, &v[kk], &color[kk], 1, ids ? &ids[kk] : 0, &cached);
+						} else {
+							Light<Flash, Refl, Lamp>( 0, v[kk], cached, color[kk]);
+							if (ids)
+								ids[kk] = cached.imin;
+						}
+					}
+				} else {
+					STAT( PRIMARY, n);
+					if (n == 1 && !ids && !hits)
+						Trace<Flash, Refl, Lamp>( 0, m_e, v[0], color[0]);
+					else if (n)
+						TracePacket<Flash, Refl, Lamp>( m_e, v, color, n, ids, hits);
+				}
+				for (unsigned kk = 0; hits && kk < n; kk++) {
+					m_gbuf[(m_h - py[kk] - 1) * m_w + px[kk]] = hits[kk];
+				}
+				for (unsigned kk = 0; kk < n; kk++) {
+					for (unsigned yy = py[kk]; yy < py[kk] + step && yy < m_h; yy++) {
+						for (unsigned xx = px[kk]; xx < px[kk] + step && xx < m_w; xx++) {
+							m_arr[(((m_h - yy - 1) * m_w + xx) * 3) + 0] = color[kk][0];
+							m_arr[(((m_h - yy - 1) * m_w + xx) * 3) + 1] = color[kk][1];
+							m_arr[(((m_h - yy - 1) * m_w + xx) * 3) + 2] = color[kk][2];
+							if (ids)
+								m_ids[(m_h - yy - 1) * m_w + xx] = ids[kk];
+						}
+					}
+				}
+			}
+		}
+		STAT_GATHER( m_stats);
+	}
+#define AA_GRID 3		// default anti-aliasing grid (aa key)
+#define AA_CONTRAST 0.1		// color difference (any channel) making an anti-aliasing edge
+	unsigned Aa() const {
+		return m_aa;
+	}
+	// grid x grid samples per edge pixel (0 or 1 => off)
+	void Aa( unsigned grid) {
+		m_aa = grid ? grid : 1;
+	}
+	// adaptive anti-aliasing of a complete frame (one ray per pixel) : pixels whose hit object or color
+	// differ from one of their neighbours are supersampled, the flat areas keep their single ray
+	// edges are all found before any pixel changes, so that the result does not depend on the tiling
+	void Refine() const {
+		STAT_PHASE( m_stats, REFINE);
+		auto edges = [this]( unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+			for (unsigned jj = y0; jj < y1; jj++) {
+				for (unsigned ii = x0; ii < x1; ii++) {
+					unsigned k = (m_h - jj - 1) * m_w + ii;
+					int edge = 0;
+					if (ii > 0)
+						edge |= Edge( k, k - 1);
+					if (ii + 1 < m_w)
+						edge |= Edge( k, k + 1);
+					if (jj > 0)
+						edge |= Edge( k, k + m_w);
+					if (jj + 1 < m_h)
+						edge |= Edge( k, k - m_w);
+					m_edges[k] = edge;
+				}
+			}
+		};
+		Refiner refiner = RefineTiler( m_frame.mode);
+		unsigned grid = m_frame.aa;
+		auto refine = [this, refiner, grid]( unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
+			(this->*refiner)( x0, y0, x1, y1, grid);
+		};
+		if (m_pool) {
+			m_pool->Run( m_w, m_h, edges);
+			m_pool->Run( m_w, m_h, refine);
+		} else {
+			edges( 0, 0, m_w, m_h);
+			refine( 0, 0, m_w, m_h);
+		}
+	}
+	// do pixels k and l (m_arr order) look different ?
+	int Edge( unsigned k, unsigned l) const {
+		if (m_ids[k] != m_ids[l])
+			return 1;
+		for (unsigned ii = 0; ii < 3; ii++) {
+			if (fabs( m_arr[k * 3 + ii] - m_arr[l * 3 + ii]) > AA_CONTRAST)
+				return 1;
+		}
+		return 0;
+	}
+	typedef void (CRealist::*Refiner)( unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned grid) const;
+	// RefineTile instantiation of a lighting mode
+	static Refiner RefineTiler( int mode) {
+		switch (mode) {
+			case FLASH:		return &CRealist::RefineTile<1, 0, 0>;
+			case REFL:		return &CRealist::RefineTile<0, 1, 0>;
+			case FLASH | REFL:	return &CRealist::RefineTile<1, 1, 0>;
+			case LAMP:		return &CRealist::RefineTile<0, 0, 1>;
+			case FLASH | LAMP:	return &CRealist::RefineTile<1, 0, 1>;
+			case REFL | LAMP:	return &CRealist::RefineTile<0, 1, 1>;
+			case FLASH | REFL | LAMP:	return &CRealist::RefineTile<1, 1, 1>;
+			default:		return &CRealist::RefineTile<0, 0, 0>;
+		}
+	}
+	// replaces the edge pixels of [x0,x1[ x [y0,y1[ by the mean of grid x grid regular sub-pixel samples
+	// (for odd grids, the center sample is the pixel ray already traced)
+	template<int Flash, int Refl, int Lamp> void RefineTile( unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned grid) const {
+		v3 v[PACKET * PACKET];
+		v3 color[PACKET * PACKET];
+		unsigned center = grid & 1 ? grid * grid / 2 : grid * grid;
+		for (unsigned jj = y0; jj < y1; jj++) {
+			for (unsigned ii = x0; ii < x1; ii++) {
+				unsigned k = (m_h - jj - 1) * m_w + ii;
+				if (!m_edges[k])
+					continue;
+				v3 sum = { 0, 0, 0};
+				if (center < grid * grid)
+					sum = v3( &m_arr[k * 3]);
+				unsigned n = 0;
+				for (unsigned ss = 0; ss < grid * grid; ss++) {
+					if (ss != center) {
+						v[n] = Ray( ii + (ss % grid + 0.5) / grid - 0.5, jj + (ss / grid + 0.5) / grid - 0.5);
+						color[n] = v3( 1, 1, 1);
+						n++;
+					}
+					if (n && (n == PACKET * PACKET || ss == grid * grid - 1)) {
+						STAT( SAMPLES, n);
+						TracePacket<Flash, Refl, Lamp>( m_e, v, color, n);
+						for (unsigned kk = 0; kk < n; kk++) {
+							sum += color[kk];
+						}
+						n = 0;
+					}
+				}
+				sum = sum / (grid * grid);
+				m_arr[k * 3 + 0] = sum[0];
+				m_arr[k * 3 + 1] = sum[1];
+				m_arr[k * 3 + 2] = sum[2];
+			}
+		}
+		STAT_GATHER( m_stats);
+	}
+	// headless output : bands of rows are rendered from the top of the image down,
+	// each one streamed out (P3 on stdout) as soon as it is done
+	void Stream() {
+		CPnm out( stdout, 0, m_w, m_h, 100);
+		unsigned band = m_pool ? m_pool->Tile() : 32;
+		// anti-aliasing needs the neighbours of every pixel : the whole frame is rendered first
+		int whole = m_frame.aa > 1;
+		if (whole) {
+			Render();
+			Refine();
+		}
+		for (unsigned j0 = 0; j0 < m_h; j0 += band) {
+			unsigned j1 = j0 + band < m_h ? j0 + band : m_h;
+			if (!whole)
+				Render( 1, 0, m_h - j1, m_h - j0);
+			STAT_PHASE( m_stats, OUTPUT);
+			Output( out, m_arr, j0, j1);
+		}
+	}
+	// rows [j0,j1[ (from the top) of image arr
+	void Output( CPnm& out, const double *arr, unsigned j0, unsigned j1) const {
+		int do_ascii = 0;
+		for (unsigned jj = j0; jj < j1; jj++) {
 			for (unsigned ii = 0; ii < m_w; ii++) {
-				v3 vr[3];
-				vr[0] = m_r * ((double)ii - 1 - m_w / 2) / m_w * m_ww;
-				vr[1] = m_r * ((double)ii + 0 - m_w / 2) / m_w * m_ww;
-				vr[2] = m_r * ((double)ii + 1 - m_w / 2) / m_w * m_ww;
-				// rays
-				v3 e[9];
-				v3 v[9];
-				v[0] = m_f + vu[0] + vr[0];
-				v[1] = m_f + vu[0] + vr[1];
-				v[2] = m_f + vu[0] + vr[2];
-				v[3] = m_f + vu[1] + vr[0];
-				v[4] = m_f + vu[1] + vr[1];
-				v[5] = m_f + vu[1] + vr[2];
-				v[6] = m_f + vu[2] + vr[0];
-				v[7] = m_f + vu[2] + vr[1];
-				v[8] = m_f + vu[2] + vr[2];
-				
-				// focal point for this pixel
-				// current pixel (center of 9x9==[4])
-				v3 fp = m_e + v[4] * 2.0;			// FIXME : this focal locus is a sphere ! should be a plane instead ?
-				e[0] = m_e + v[0];
-				v[0] = ~(fp - e[0]);
-				e[1] = m_e + v[0];
-				v[1] = ~(fp - e[0]);
-				e[2] = m_e + v[0];
-				v[2] = ~(fp - e[0]);
-				e[3] = m_e + v[0];
-				v[3] = ~(fp - e[0]);
-				e[4] = m_e + v[4];
-				v[4] = ~(fp - e[4]);
-				e[5] = m_e + v[0];
-				v[5] = ~(fp - e[0]);
-				e[6] = m_e + v[0];
-				v[6] = ~(fp - e[0]);
-				e[7] = m_e + v[0];
-				v[7] = ~(fp - e[0]);
-				e[8] = m_e + v[0];
-				v[8] = ~(fp - e[0]);
-				
-				v3 pcolor[9] = {{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1},{1, 1, 1}};
-
-				Trace( 0, e[0], v[0], pcolor[0]);
-				Trace( 0, e[1], v[1], pcolor[1]);
-				Trace( 0, e[2], v[2], pcolor[2]);
-				Trace( 0, e[3], v[3], pcolor[3]);
-				Trace( 0, e[4], v[4], pcolor[4]);
-				Trace( 0, e[5], v[5], pcolor[5]);
-				Trace( 0, e[6], v[6], pcolor[6]);
-				Trace( 0, e[7], v[7], pcolor[7]);
-				Trace( 0, e[8], v[8], pcolor[8]);
-
-				v3 color;
-				color = (pcolor[0] + pcolor[1] + pcolor[2] + pcolor[3]) / 4;
-				color = pcolor[4];
-
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 0] = color[0];
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 1] = color[1];
-				m_arr[(((m_h - jj - 1) * m_w + ii) * 3) + 2] = color[2];
+				double r, g, b;
+				r = arr[((jj * m_w + ii) * 3) + 0];
+				g = arr[((jj * m_w + ii) * 3) + 1];
+				b = arr[((jj * m_w + ii) * 3) + 2];
+				if (do_ascii) {
+					char col;
+					if (r >= g && r >= b) {
+						if (b > 0) {
+							if (g > 0) {
+								col = 'W';
+							} else {
+								col = 'V';
+							}
+						} else if (g > 0) {
+							col = 'M';
+						} else if (r > 0) {
+							col = 'R';
+						} else {
+							col = '.';
+						}
+					} else if (g >= b) {
+						if (b > 0) {
+							col = 'Y';
+						} else {
+							col = 'G';
+						}
+					} else if (b > 0) {
+						col = 'B';
+					} else {
+						col = 'K';
+					}
+					out.Put( col);
+				}
+				else
+					out.Pixel( r, g, b);
 			}
+			out.EndRow();
 		}
 	}
-	void Run( int nosdl = 0, unsigned w = 0, unsigned h = 0) {
+	// headless animation : every frame of the camera path (see LoadPath()) is rendered to its own
+	// P6 image; the scene, its hierarchy and the buffers are kept from one frame to the next (the
+	// lamp moves outside the hierarchy, which is built once), and with threads, frame n is written out by
+	// a separate thread while frame n + 1 renders
+	int Batch() {
+		double *spare = (double *)malloc( m_sz);	// frame being written out
+		std::thread writer;
+		int result = 0;
+		const char *prefix = m_prefix ? m_prefix : "frame";
+		unsigned first = m_keys.front().frame, last = m_keys.back().frame;
+		for (unsigned frame = first; frame <= last; frame++) {
+#ifdef USE_STATS
+			m_stats.Begin();
+#endif
+			Key( frame);
+			if (frame == first)
+				Prepare();
+			Frame();
+			Render();
+			if (m_frame.aa > 1)
+				Refine();
+			if (writer.joinable())
+				writer.join();
+			if (result)
+				break;
+			std::swap( m_arr, spare);
+			char name[1024];
+			snprintf( name, sizeof( name), "%s%04u.ppm", prefix, frame);
+			std::string fname = name;
+			const double *arr = spare;
+			auto write = [this, fname, arr, &result]() {
+				FILE *f = fopen( fname.c_str(), "wb");
+				if (!f) {
+					printf( "failed to create %s\n", fname.c_str());
+					result = -1;
+					return;
+				}
+				{
+					CPnm out( f, 1, m_w, m_h, 255);
+					Output( out, arr, 0, m_h);
+				}
+				fclose( f);
+			};
+			if (m_pool) {
+				writer = std::thread( write);
+			} else {
+				STAT_PHASE( m_stats, OUTPUT);
+				write();
+			}
+#ifdef USE_STATS
+			m_stats.End();
+			m_stats.Json( std::cerr);
+#endif
+		}
+		if (writer.joinable())
+			writer.join();
+		free( spare);
+		return result;
+	}
+	void Run( int nosdl = 0, unsigned w = 0, unsigned h = 0, unsigned threads = 0, unsigned tile = 0, unsigned coarse = 8) {
 #ifdef USE_OPT
 //		printf( "# using OPT\n");
 #else
 //		printf( "# *NOT* using OPT\n");
 #endif
+		if (threads != 1)
+			m_pool = new CPool( threads, tile);
 		CSDL *sdl = 0;
 		if (!nosdl)
 			sdl = new CSDL;
@@ -762,28 +1422,102 @@ poszlampmin= 0.700000 poszlampmax= 1.046431
 //		printf( "# ww=%f hh=%f\n", m_ww, m_hh);
 
 //		printf( "# found %d objects\n", (int)m_objs.size());
-		if (!sdl) {
-			printf( "P3\n");
-//			printf( "# raycpp\n");
-			printf( "%d %d\n", m_w, m_h);
-			printf( "%d\n", 100);
-		}
-
 		memset( m_arr, 0, m_sz);
+		// progressive refinement : a coarse pass (one ray per coarse x coarse block) is shown first,
+		// then each pass halves the step; passes are cut in slices of about the coarse pass cost
+		// so that events are polled (and refinement restarted) with the coarse pass latency
+		if (!sdl || !coarse)
+			coarse = 1;
+		while (coarse & (coarse - 1))
+			coarse &= coarse - 1;		// round down to a power of two
+		unsigned step = 0;	// current pass step (0 => frame complete)
+		unsigned done = 0;	// step of the last complete pass
+		unsigned slice = 0, nslices = 0;
 		int quit = 0;
 		int dirty = 1;
+		int moved = 1;		// objects moved : acceleration data must be rebuilt
+		int geometry = 1;	// camera, lighting mode or objects (but lamps) changed : primary hits must be traced
+		int cached = 0;		// the G-buffer holds the primary hits of the current geometry
+		if (!sdl) {
+#ifdef USE_STATS
+			m_stats.Begin();
+#endif
+			if (m_keys.size()) {
+				Batch();
+			} else {
+				Prepare();
+				Frame();
+				Stream();
+			}
+			quit = 1;
+#ifdef USE_STATS
+			if (!m_keys.size()) {
+				m_stats.End();
+				m_stats.Json( std::cerr);
+			}
+#endif
+		}
 		while (!quit) {
 			if (dirty) {
-				Render( /*t*/);
-				t += 0.1;
-				if (sdl)
-					sdl->Draw( m_arr);
+#ifdef USE_STATS
+				m_stats.Begin();
+#endif
+				if (moved) {
+					Prepare();
+					moved = 0;
+				}
+				if (geometry)
+					cached = 0;
+				geometry = 0;
+				Frame( cached ? RELIGHT : RECORD);
+				step = coarse;
+				done = 0;
+				slice = 0;
 				dirty = 0;
+			}
+			if (step) {
+				if (!slice) {
+					nslices = (coarse / step) * (coarse / step);
+				}
+				unsigned rows = (m_h / nslices + step - 1) / step * step;
+				if (!rows)
+					rows = step;
+				unsigned y0 = slice * rows;
+				unsigned y1 = y0 + rows;
+				if (y1 > m_h || slice == nslices - 1)
+					y1 = m_h;
+				Render( step, done, y0, y1);
+				if (y1 == m_h) {
+					// pass complete
+					if (step == 1 && m_frame.aa > 1)
+						Refine();
+					if (sdl) {
+						STAT_PHASE( m_stats, DRAW);
+						sdl->Draw( m_arr);
+					}
+					done = step;
+					step /= 2;
+					slice = 0;
+					if (!step) {
+						t += 0.1;
+						cached = 1;
+#ifdef USE_STATS
+						m_stats.End();
+						char title[128];
+						m_stats.Title( title, sizeof( title));
+						if (sdl)
+							sdl->Title( title);
+#endif
+					}
+				} else {
+					slice++;
+				}
 			} else {
 				if (sdl)
 					sdl->Delay( 100);
 			}
 			if (sdl) {
+				STAT_PHASE( m_stats, EVENTS);
 				int ev;
 				do {
 					int ctrl = 0;
@@ -829,6 +1563,28 @@ poszlampmin= 0.700000 poszlampmax= 1.046431
 							JsonScene( std::cout);
 							modif = 0;
 							break;
+#ifdef USE_STATS
+						case CSDL::K_s:
+							m_stats.Json( std::cout);
+							modif = 0;
+							break;
+#endif
+						case CSDL::K_f:
+						case CSDL::K_r:
+						case CSDL::K_l:
+							// toggle a lighting mode
+							Mode( m_mode ^ (ev == CSDL::K_f ? FLASH : ev == CSDL::K_r ? REFL : LAMP));
+							PrintMode( m_mode);
+							dirty = 1;
+							geometry = 1;
+							modif = 0;
+							break;
+						case CSDL::K_a:
+							Aa( m_aa > 1 ? 1 : AA_GRID);
+							printf( "aa: %ux%u\n", m_aa, m_aa);
+							dirty = 1;
+							modif = 0;
+							break;
 						default:
 							modif = 0;
 							break;
@@ -882,15 +1638,12 @@ poszlampmin= 0.700000 poszlampmax= 1.046431
 								m_f[1] = y;
 								m_f[2] = z;
 
-								m_u = ~m_u;
-								m_r = m_f ^ m_u;		// compute right
-								m_u = m_r ^ m_f;		// re-compute up
-								m_u = ~m_u;
-								m_r = ~m_r;
+								Orient();
 							}
 							else {
 								m_e += rv;
 							}
+							geometry = 1;
 						}
 						dirty = 1;
 					}
@@ -899,54 +1652,16 @@ poszlampmin= 0.700000 poszlampmax= 1.046431
 					break;
 				if (dirty) {
 				}
-			} else {
-					int do_ascii = 0;
-					for (unsigned jj = 0; jj < m_h; jj++) {
-					for (unsigned ii = 0; ii < m_w; ii++) {
-						double r, g, b;
-						r = m_arr[((jj * m_w + ii) * 3) + 0];
-						g = m_arr[((jj * m_w + ii) * 3) + 1];
-						b = m_arr[((jj * m_w + ii) * 3) + 2];
-						if (do_ascii) {
-							char col;
-							if (r >= g && r >= b) {
-								if (b > 0) {
-									if (g > 0) {
-										col = 'W';
-									} else {
-										col = 'V';
-									}
-								} else if (g > 0) {
-									col = 'M';
-								} else if (r > 0) {
-									col = 'R';
-								} else {
-									col = '.';
-								}
-							} else if (g >= b) {
-								if (b > 0) {
-									col = 'Y';
-								} else {
-									col = 'G';
-								}
-							} else if (b > 0) {
-								col = 'B';
-							} else {
-								col = 'K';
-							}
-							printf( "%c", col);
-						}
-						else
-							printf( "%2.lf %2.lf %2.lf   ", 100*r, 100*g, 100*b);
-					}
-					printf( "\n");
-				}
-				break;
 			}
 		}
 		free( m_arr);
+		if (m_pool) {
+			delete m_pool;
+			m_pool = 0;
+		}
 		for (unsigned ii = 0; ii < m_objs.size(); ii++) {
-			delete m_objs.at( ii);
+			if (!Loaded( m_objs.at( ii)))
+				delete m_objs.at( ii);
 			m_objs.at( ii) = 0;
 		}
 		if (sdl) {
@@ -966,11 +1681,30 @@ private:
 	v3 m_u;	// up along screen
 	v3 m_r;	// right along screen (computed)
 	double m_ww, m_hh;	// screen dimensions (space)
+	CPool *m_pool;	// tile renderer (0 => single-threaded)
+	CSpheresT<real> m_spheres;	// SoA copy of the spheres of m_objs
+	std::vector<unsigned> m_others;	// indices of the non-sphere objects and of the lamps of m_objs
+	std::vector<CSphere> m_loaded;	// spheres of a binary scene, in one block (see LoadScene())
+	int m_filled;	// m_spheres already holds the m_loaded spheres (see Prepare())
+	int m_mode;		// lighting mode (FLASH|REFL|LAMP), applied by the next Frame()
+	CFrame m_frame;	// per frame shading context (see Frame())
+	unsigned m_aa;		// anti-aliasing grid (1 => off), applied by the next Frame()
+	mutable std::vector<unsigned> m_ids;	// primary hit object of each pixel (m_arr order), when anti-aliasing
+	mutable std::vector<unsigned char> m_edges;	// pixels to be supersampled
+	mutable std::vector<CHit> m_gbuf;	// primary hit of each pixel (m_arr order), see Frame()
+	std::vector<CKey> m_keys;	// camera path (empty => single frame)
+	const char *m_prefix;	// camera path images
+#ifdef USE_STATS
+	mutable CStats m_stats;	// hot path counters and phase timings
+#endif
 };
 
 int main( int argc, char *argv[]) {
 	unsigned w = 0, h = 0;
 	int nosdl = 0;
+	unsigned threads = 0, tile = 0, coarse = 8, aa = 1;
+	const char *lighting = 0;
+	const char *path = 0, *prefix = 0;
 	char *scene = 0;
 	int arg = 1;
 	if (arg < argc) {
@@ -981,11 +1715,43 @@ int main( int argc, char *argv[]) {
 				sscanf( argv[arg++], "%d", &h);
 				if (arg < argc) {
 					sscanf( argv[arg++], "%d", &nosdl);
+					if (arg < argc) {
+						sscanf( argv[arg++], "%u", &threads);
+						if (arg < argc) {
+							sscanf( argv[arg++], "%u", &tile);
+							if (arg < argc) {
+								sscanf( argv[arg++], "%u", &coarse);
+								if (arg < argc) {
+									lighting = argv[arg++];
+									if (arg < argc) {
+										sscanf( argv[arg++], "%u", &aa);
+										if (arg < argc) {
+											path = argv[arg++];
+											if (arg < argc) {
+												prefix = argv[arg++];
+											}
+										}
+									}
+								}
+							}
+						}
+					}
 				}
 			}
 		}
 	}
 	CRealist r( scene);
-	r.Run( nosdl, w, h);
+	if (lighting)
+		r.Mode( CRealist::ParseMode( lighting));
+	r.Aa( aa);
+	if (path) {
+		if (r.LoadPath( path)) {
+			printf( "failed to load path %s\n", path);
+			exit( 1);
+		}
+		r.Prefix( prefix);
+		nosdl = 1;
+	}
+	r.Run( nosdl, w, h, threads, tile, coarse);
 	return 0;
 }
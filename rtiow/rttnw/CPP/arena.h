@@ -0,0 +1,129 @@
+#ifndef ARENAH
+#define ARENAH
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// scene arena : the objects of a scene (hittables, materials, textures and their pointer
+// arrays) are carved one after the other out of large blocks, instead of one heap
+// allocation each, and are all destroyed and freed at once with the arena
+class scene_arena {
+    public:
+        scene_arena(size_t block_size = 1 << 20) : block_size(block_size), cur(0), left(0), bytes(0) {}
+        ~scene_arena() { release(); }
+
+        void *alloc(size_t size) {
+            const size_t align = alignof(std::max_align_t);
+            size = (size + align - 1) & ~(align - 1);
+            bytes += size;
+            // a dedicated block for the large requests, that would waste the current one
+            if (size > block_size/4)
+                return new_block(size);
+            if (size > left) {
+                cur = new_block(block_size);
+                left = block_size;
+            }
+            void *p = cur;
+            cur += size;
+            left -= size;
+            return p;
+        }
+        // p is destroyed (in reverse order of creation) when the arena is released
+        void own(void *p, void (*destroy)(void *)) {
+            owned.push_back(object(p, destroy));
+        }
+        // p is no longer to be destroyed by the arena (its constructor threw, or it was deleted);
+        // its memory stays in the arena until release
+        void disown(void *p) {
+            for (size_t i = owned.size(); i-- > 0; ) {
+                if (owned[i].p == p) {
+                    owned.erase(owned.begin() + i);
+                    return;
+                }
+            }
+        }
+        void release() {
+            for (size_t i = owned.size(); i-- > 0; )
+                owned[i].destroy(owned[i].p);
+            owned.clear();
+            for (size_t i = 0; i < blocks.size(); i++)
+                free(blocks[i].p);
+            blocks.clear();
+            cur = 0;
+            left = 0;
+            bytes = 0;
+        }
+        size_t objects() const { return owned.size(); }
+        size_t used() const { return bytes; }
+        size_t nblocks() const { return blocks.size(); }
+
+    private:
+        char *new_block(size_t size) {
+            char *b = (char *)malloc(size);
+            if (!b)
+                throw std::bad_alloc();
+            blocks.push_back(block(b, size));
+            return b;
+        }
+        struct block {
+            block(char *p, size_t size) : p(p), size(size) {}
+            char *p;
+            size_t size;
+        };
+        struct object {
+            object(void *p, void (*destroy)(void *)) : p(p), destroy(destroy) {}
+            void *p;
+            void (*destroy)(void *);
+        };
+        size_t block_size;
+        char *cur;              // free space of the current block
+        size_t left;
+        size_t bytes;           // handed out
+        std::vector<block> blocks;
+        std::vector<object> owned;
+};
+
+// arena of the scene being built (0 => plain heap) : to be reset once the scene is built,
+// the arena is not thread safe
+scene_arena *current_arena = 0;
+
+// base of the polymorphic scene classes : new puts them in the current arena, which
+// destroys them through their (virtual) destructor when released
+// each object is preceded by the arena holding it (0 => heap), so that delete, also
+// called by a new expression whose constructor threw, finds it once current_arena changed :
+// the object is then disowned, and never destroyed again by the arena
+template<class T> class arena_allocated {
+    public:
+        static void *operator new(size_t size) {
+            scene_arena *arena = current_arena;
+            char *b = (char *)(arena ? arena->alloc(header + size) : ::operator new(header + size));
+            *(scene_arena **)b = arena;
+            if (arena)
+                arena->own(b + header, destroy);
+            return b + header;
+        }
+        static void operator delete(void *p) {
+            if (!p)
+                return;
+            char *b = (char *)p - header;
+            scene_arena *arena = *(scene_arena **)b;
+            if (arena)
+                arena->disown(p);
+            else
+                ::operator delete(b);
+        }
+    private:
+        static const size_t header = alignof(std::max_align_t);
+        static void destroy(void *p) { static_cast<T *>(p)->~T(); }
+};
+
+// array of n pointers (or other plain values), in the current arena if any
+template<class T> T *scene_array(int n) {
+    if (!current_arena)
+        return new T[n];
+    return (T *)current_arena->alloc(n*sizeof(T));
+}
+
+#endif
@@ -1,10 +1,29 @@
 #ifndef HITTABLEH
 #define HITTABLEH
 
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <vector>
+
+#if defined __AVX__
+#include <immintrin.h>
+#elif defined __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "arena.h"
+#include "random.h"
 #include "ray.h"
 
-extern int sph_hit;
-extern int msph_hit;
+// per thread intersection counters : each render thread counts its own, to be summed
+struct hit_stats_t {
+    unsigned long long sph;     // sphere tests
+    unsigned long long msph;    // moving sphere tests
+    unsigned long long visits;  // bvh node boxes tested
+};
+thread_local hit_stats_t hit_stats;
 
 class material;
 
@@ -21,6 +40,37 @@ struct hit_record
 inline float ffmin(float a, float b) { return a < b ? a : b; }
 inline float ffmax(float a, float b) { return a > b ? a : b; }
 
+// slab test of the box [bmin,bmax] against the ray, over ]tmin,tmax[ : multiplies by the
+// precomputed reciprocal direction; with sse the three axes are done at once, branchless
+// (min/max propagate like ffmin/ffmax when a lane is NaN, 0*inf on a slab plane)
+inline bool slab_hit(const float *bmin, const float *bmax, const ray& r, float tmin, float tmax) {
+#if defined __SSE__
+    // the x axis is duplicated into the fourth lane
+    __m128 o = _mm_setr_ps(r.A[0], r.A[1], r.A[2], r.A[0]);
+    __m128 inv = _mm_setr_ps(r.inv_B[0], r.inv_B[1], r.inv_B[2], r.inv_B[0]);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(bmin[0], bmin[1], bmin[2], bmin[0]), o), inv);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(bmax[0], bmax[1], bmax[2], bmax[0]), o), inv);
+    __m128 tn = _mm_max_ps(_mm_min_ps(t0, t1), _mm_set1_ps(tmin));
+    __m128 tf = _mm_min_ps(_mm_max_ps(t0, t1), _mm_set1_ps(tmax));
+    tn = _mm_max_ps(tn, _mm_shuffle_ps(tn, tn, _MM_SHUFFLE(2, 3, 0, 1)));
+    tn = _mm_max_ps(tn, _mm_shuffle_ps(tn, tn, _MM_SHUFFLE(1, 0, 3, 2)));
+    tf = _mm_min_ps(tf, _mm_shuffle_ps(tf, tf, _MM_SHUFFLE(2, 3, 0, 1)));
+    tf = _mm_min_ps(tf, _mm_shuffle_ps(tf, tf, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_comilt_ss(tn, tf);
+#else
+    const float *b[2] = { bmin, bmax };
+    for (int a = 0; a < 3; a++) {
+        float t0 = (b[r.sign[a]][a] - r.A[a]) * r.inv_B[a];
+        float t1 = (b[1 - r.sign[a]][a] - r.A[a]) * r.inv_B[a];
+        tmin = ffmax(t0, tmin);
+        tmax = ffmin(t1, tmax);
+        if (tmax <= tmin)
+            return false;
+    }
+    return true;
+#endif
+}
+
 class aabb {
     public:
         aabb() {}
@@ -30,40 +80,13 @@ class aabb {
         vec3 max() const {return _max; }
 
         bool hit(const ray& r, float tmin, float tmax) const {
-            for (int a = 0; a < 3; a++) {
-                float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                                 (_max[a] - r.origin()[a]) / r.direction()[a]);
-                float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                                 (_max[a] - r.origin()[a]) / r.direction()[a]);
-                tmin = ffmax(t0, tmin);
-                tmax = ffmin(t1, tmax);
-                if (tmax <= tmin)
-                    return false;
-            }
-            return true;
+            return slab_hit(_min.e, _max.e, r, tmin, tmax);
         }
 
         vec3 _min;
         vec3 _max;
 };
 
-#if 0
-inline bool aabb::hit(const ray& r, float tmin, float tmax) const {
-    for (int a = 0; a < 3; a++) {
-        float invD = 1.0f / r.direction()[a];
-        float t0 = (min()[a] - r.origin()[a]) * invD;
-        float t1 = (max()[a] - r.origin()[a]) * invD;
-        if (invD < 0.0f)
-            std::swap(t0, t1);
-        tmin = t0 > tmin ? t0 : tmin;
-        tmax = t1 < tmax ? t1 : tmax;
-        if (tmax <= tmin)
-            return false;
-    }
-    return true;
-}
-#endif
-
 aabb surrounding_box(aabb box0, aabb box1) {
     vec3 small( ffmin(box0.min().x(), box1.min().x()),
                 ffmin(box0.min().y(), box1.min().y()),
@@ -74,36 +97,405 @@ aabb surrounding_box(aabb box0, aabb box1) {
     return aabb(small,big);
 }
 
-class hittable {
+class hittable : public arena_allocated<hittable> {
     public:
+        virtual ~hittable() {}
         virtual bool hit(
             const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
 };
 
+// bvh builders : binned surface area heuristic (leaves of up to BVH_LEAF objects),
+// or the original random axis / median count split (one or two objects per node)
+// past BVH_SAH_DEPTH levels, the sah builder halves the objects instead, so that clustered
+// centroids peeling off a few objects per level cannot make the tree deeper than the
+// BVH_STACK entries of the compiled traversals (BVH_SAH_DEPTH + log2(objects) levels)
+enum { BVH_SAH, BVH_MEDIAN };
+enum { BVH_LEAF = 4, BVH_BINS = 16, BVH_SAH_DEPTH = 32, BVH_STACK = 64 };
+int bvh_method = BVH_SAH;   // builder of the bvh_node constructor
+int bvh_flatten = 1;        // bvh_node trees are compiled into a bvh_flat (0 => recursive traversal)
+int bvh_width = 2;          // 4 or 8 : compiled into a bvh_wide of that width instead
+
+// build cost, for the render stats (traversal is counted in hit_stats)
+struct bvh_stats_t {
+    double build_time;  // seconds
+    int nodes;
+    int leaves;     // bvh_leaf objects (the median builder has none)
+};
+bvh_stats_t bvh_stats;
+
+// an object of a bvh build : bounds and centroid are computed once
+struct bvh_prim {
+    hittable *h;
+    aabb box;
+    vec3 c;
+};
+
 class bvh_node : public hittable {
     public:
-        bvh_node() {}
-        bvh_node(hittable **l, int n, float time0, float time1);
+        bvh_node() : compiled(0) {}
+        bvh_node(hittable **l, int n, float time0, float time1, int method = bvh_method);
 
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
 
         hittable *left;
-        hittable *right;
+        hittable *right;    // may be left itself (single child)
+        aabb box;
+        hittable *compiled; // bvh_flat/bvh_wide copy of the tree (root node only), used by hit()
+    private:
+        void build_median(hittable **l, int n, float time0, float time1);
+        void build_sah(bvh_prim *p, int n, const aabb& bounds, int m, int depth);
+        static hittable *sah_subtree(bvh_prim *p, int n, int depth);
+};
+
+// bvh leaf holding several objects (closest hit among them)
+class bvh_leaf : public hittable {
+    public:
+        bvh_leaf(const bvh_prim *p, int n, const aabb& b) : list_size(n), box(b) {
+            list = scene_array<hittable*>(n);
+            for (int i = 0; i < n; i++)
+                list[i] = p[i].h;
+        }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            bool hit_anything = false;
+            for (int i = 0; i < list_size; i++) {
+                if (list[i]->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+        virtual bool bounding_box(float, float, aabb& b) const {
+            b = box;
+            return true;
+        }
+        hittable **list;
+        int list_size;
+        aabb box;
+};
+
+// flattened bvh node : 32 bytes, depth first order (the first child follows its parent)
+struct bvh_flat_node {
+    float bmin[3];
+    float bmax[3];
+    int offset;             // interior : second child index, leaf : first object index
+    unsigned short count;   // leaf objects count (0 => interior node)
+    unsigned short axis;    // interior : the first child is the lower one along this axis
+};
+static_assert(sizeof(bvh_flat_node) == 32, "bvh_flat_node is not 32 bytes");
+
+// bvh compiled from a bvh_node tree into contiguous nodes, traversed iteratively,
+// nearer child first, the closest hit so far shrinking t_max
+class bvh_flat : public hittable {
+    public:
+        bvh_flat(hittable *root, float time0, float time1) : depth(0), t0(time0), t1(time1) {
+            root->bounding_box(t0, t1, box);
+            flatten(root, 1);
+            assert(depth <= BVH_STACK);
+        }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float, float, aabb& b) const {
+            b = box;
+            return true;
+        }
+
+        std::vector<bvh_flat_node> nodes;
+        std::vector<hittable*> prims;
+        int depth;          // levels of nodes (the traversal stacks at most one entry per level)
+    private:
+        int flatten(hittable *h, int level);
+        int add_node(hittable *h);
+        float t0, t1;
+        aabb box;
+};
+
+int bvh_flat::add_node(hittable *h) {
+    aabb b;
+    h->bounding_box(t0, t1, b);
+    bvh_flat_node n;
+    for (int a = 0; a < 3; a++) {
+        n.bmin[a] = b.min()[a];
+        n.bmax[a] = b.max()[a];
+    }
+    n.offset = 0;
+    n.count = 0;
+    n.axis = 0;
+    nodes.push_back(n);
+    return nodes.size() - 1;
+}
+
+// appends the subtree of h (at depth level), returns its index
+int bvh_flat::flatten(hittable *h, int level) {
+    bvh_node *node = dynamic_cast<bvh_node*>(h);
+    if (node && node->right == node->left)
+        return flatten(node->left, level);
+    depth = std::max(depth, level);
+    int i = add_node(h);
+    if (node) {
+        // order the children along the axis their centers are the most apart on
+        aabb lb, rb;
+        node->left->bounding_box(t0, t1, lb);
+        node->right->bounding_box(t0, t1, rb);
+        vec3 d = (rb.min() + rb.max()) - (lb.min() + lb.max());
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (fabs(d[a]) > fabs(d[axis]))
+                axis = a;
+        hittable *first = node->left, *second = node->right;
+        if (d[axis] < 0)
+            std::swap(first, second);
+        flatten(first, level + 1);
+        int second_index = flatten(second, level + 1);
+        nodes[i].offset = second_index;
+        nodes[i].axis = axis;
+        return i;
+    }
+    nodes[i].offset = prims.size();
+    bvh_leaf *leaf = dynamic_cast<bvh_leaf*>(h);
+    if (leaf)
+        prims.insert(prims.end(), leaf->list, leaf->list + leaf->list_size);
+    else
+        prims.push_back(h);
+    nodes[i].count = prims.size() - nodes[i].offset;
+    return i;
+}
+
+bool bvh_flat::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    int stack[BVH_STACK];
+    int sp = 0;
+    int i = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const bvh_flat_node& n = nodes[i];
+        hit_stats.visits++;
+        if (slab_hit(n.bmin, n.bmax, r, t_min, t_max)) {
+            if (!n.count) {
+                if (r.sign[n.axis]) {
+                    stack[sp++] = i + 1;
+                    i = n.offset;
+                }
+                else {
+                    stack[sp++] = n.offset;
+                    i = i + 1;
+                }
+                continue;
+            }
+            for (int k = n.offset; k < n.offset + n.count; k++) {
+                if (prims[k]->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+        }
+        if (!sp)
+            break;
+        i = stack[--sp];
+    }
+    return hit_anything;
+}
+
+inline float surface_area(const aabb& b) {
+    vec3 d = b.max() - b.min();
+    return 2*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+// wide bvh node : the bounds of W children in SoA layout, tested at once
+// a child is either a node (count 0) or a leaf of count objects; unused lanes have inverted
+// bounds, that no ray can hit
+template<int W> struct bvh_wide_node {
+    float bmin[3][W];
+    float bmax[3][W];
+    int child[W];           // node index, or first object index of a leaf
+    int count[W];
+};
+
+// W boxes of a wide node against the ray over ]t_min,t_max[ : mask of the hit lanes and their
+// entry distances; the near plane of each slab is selected by the sign of the ray direction
+template<int W> inline int wide_slab_hit(const bvh_wide_node<W>& n, const ray& r, float t_min, float t_max, float *tnear) {
+    int mask = 0;
+    for (int k = 0; k < W; k++) {
+        float tn = t_min, tf = t_max;
+        for (int a = 0; a < 3; a++) {
+            float t0 = ((r.sign[a] ? n.bmax : n.bmin)[a][k] - r.A[a]) * r.inv_B[a];
+            float t1 = ((r.sign[a] ? n.bmin : n.bmax)[a][k] - r.A[a]) * r.inv_B[a];
+            tn = ffmax(t0, tn);
+            tf = ffmin(t1, tf);
+        }
+        tnear[k] = tn;
+        mask |= (tn < tf) << k;
+    }
+    return mask;
+}
+
+#if defined __SSE__
+template<> inline int wide_slab_hit<4>(const bvh_wide_node<4>& n, const ray& r, float t_min, float t_max, float *tnear) {
+    __m128 tn = _mm_set1_ps(t_min), tf = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_set1_ps(r.A[a]), inv = _mm_set1_ps(r.inv_B[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps((r.sign[a] ? n.bmax : n.bmin)[a]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps((r.sign[a] ? n.bmin : n.bmax)[a]), o), inv);
+        tn = _mm_max_ps(t0, tn);
+        tf = _mm_min_ps(t1, tf);
+    }
+    _mm_storeu_ps(tnear, tn);
+    return _mm_movemask_ps(_mm_cmplt_ps(tn, tf));
+}
+#endif
+
+#if defined __AVX__
+template<> inline int wide_slab_hit<8>(const bvh_wide_node<8>& n, const ray& r, float t_min, float t_max, float *tnear) {
+    __m256 tn = _mm256_set1_ps(t_min), tf = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m256 o = _mm256_set1_ps(r.A[a]), inv = _mm256_set1_ps(r.inv_B[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps((r.sign[a] ? n.bmax : n.bmin)[a]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps((r.sign[a] ? n.bmin : n.bmax)[a]), o), inv);
+        tn = _mm256_max_ps(t0, tn);
+        tf = _mm256_min_ps(t1, tf);
+    }
+    _mm256_storeu_ps(tnear, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LT_OQ));
+}
+#endif
+
+// bvh of width W (4 : one sse pass per node, 8 : one avx pass), made by collapsing a
+// bvh_node tree : the largest interior children are replaced by their own children until
+// W of them are gathered; traversal is iterative, nearer children first, the closest
+// hit so far shrinking t_max
+template<int W> class bvh_wide : public hittable {
+    public:
+        bvh_wide(bvh_node *root, float time0, float time1) : depth(0), t0(time0), t1(time1) {
+            root->bounding_box(t0, t1, box);
+            collapse(root, 1);
+            assert(depth <= BVH_STACK);
+        }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float, float, aabb& b) const {
+            b = box;
+            return true;
+        }
+
+        std::vector<bvh_wide_node<W> > nodes;
+        std::vector<hittable*> prims;
+        int depth;          // levels of wide nodes (each level stacks at most W - 1 entries)
+    private:
+        int collapse(bvh_node *node, int level);
+        float t0, t1;
         aabb box;
 };
 
-bool bvh_node::bounding_box(float t0, float t1, aabb& b) const {
+// appends the wide node gathering the subtree of node (at depth level), returns its index
+template<int W> int bvh_wide<W>::collapse(bvh_node *node, int level) {
+    depth = std::max(depth, level);
+    hittable *c[W];
+    int n = 0;
+    c[n++] = node->left;
+    if (node->right != node->left)
+        c[n++] = node->right;
+    while (n < W) {
+        int best = -1;
+        float best_area = -1;
+        for (int k = 0; k < n; k++) {
+            aabb b;
+            if (dynamic_cast<bvh_node*>(c[k]) && c[k]->bounding_box(t0, t1, b) && surface_area(b) > best_area) {
+                best = k;
+                best_area = surface_area(b);
+            }
+        }
+        if (best < 0)
+            break;
+        bvh_node *expanded = (bvh_node *)c[best];
+        c[best] = expanded->left;
+        if (expanded->right != expanded->left)
+            c[n++] = expanded->right;
+    }
+    int i = nodes.size();
+    nodes.push_back(bvh_wide_node<W>());
+    for (int k = 0; k < W; k++) {
+        aabb b(vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+        int child = 0, count = 0;
+        if (k < n) {
+            c[k]->bounding_box(t0, t1, b);
+            if (bvh_node *sub = dynamic_cast<bvh_node*>(c[k]))
+                child = collapse(sub, level + 1);
+            else {
+                child = prims.size();
+                bvh_leaf *leaf = dynamic_cast<bvh_leaf*>(c[k]);
+                if (leaf)
+                    prims.insert(prims.end(), leaf->list, leaf->list + leaf->list_size);
+                else
+                    prims.push_back(c[k]);
+                count = prims.size() - child;
+            }
+        }
+        // nodes may have been reallocated by the recursion
+        bvh_wide_node<W>& wn = nodes[i];
+        for (int a = 0; a < 3; a++) {
+            wn.bmin[a][k] = b.min()[a];
+            wn.bmax[a][k] = b.max()[a];
+        }
+        wn.child[k] = child;
+        wn.count[k] = count;
+    }
+    return i;
+}
+
+template<int W> bool bvh_wide<W>::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    // pending nodes with their entry distances, the nearest on top (depth <= BVH_STACK)
+    int stack[BVH_STACK*W];
+    float stack_t[BVH_STACK*W];
+    int sp = 0;
+    stack[sp] = 0;
+    stack_t[sp++] = t_min;
+    bool hit_anything = false;
+    while (sp) {
+        sp--;
+        if (stack_t[sp] >= t_max)
+            continue;
+        const bvh_wide_node<W>& n = nodes[stack[sp]];
+        hit_stats.visits++;
+        float tnear[W];
+        int mask = wide_slab_hit(n, r, t_min, t_max, tnear);
+        int base = sp;
+        for (int k = 0; k < W; k++) {
+            if (!(mask & (1 << k)))
+                continue;
+            if (n.count[k]) {
+                for (int j = n.child[k]; j < n.child[k] + n.count[k]; j++) {
+                    if (prims[j]->hit(r, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+                continue;
+            }
+            // insertion by decreasing entry distance
+            int j = sp++;
+            for (; j > base && stack_t[j - 1] < tnear[k]; j--) {
+                stack[j] = stack[j - 1];
+                stack_t[j] = stack_t[j - 1];
+            }
+            stack[j] = n.child[k];
+            stack_t[j] = tnear[k];
+        }
+    }
+    return hit_anything;
+}
+
+bool bvh_node::bounding_box(float, float, aabb& b) const {
     b = box;
     return true;
 }
 
 bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (compiled)
+        return compiled->hit(r, t_min, t_max, rec);
+    hit_stats.visits++;
     if (box.hit(r, t_min, t_max)) {
         hit_record left_rec, right_rec;
         bool hit_left = left->hit(r, t_min, t_max, left_rec);
-        bool hit_right = right->hit(r, t_min, t_max, right_rec);
+        bool hit_right = right != left && right->hit(r, t_min, t_max, right_rec);
         if (hit_left && hit_right) {
             if (left_rec.t < right_rec.t)
                 rec = left_rec;
@@ -167,7 +559,145 @@ int box_z_compare (const void * a, const void * b) {
         return 1;
 }
 
-bvh_node::bvh_node(hittable **l, int n, float time0, float time1) {
+// binned sah : the centroids of the n objects are binned along each axis, and the
+// split plane between two bins minimizing the estimated traversal cost is kept
+// (costs in box tests, an object test counting as one); the objects are partitioned
+// accordingly and the count of the left ones is returned, 0 when a leaf is cheaper
+int bvh_sah_split(bvh_prim *p, int n, const aabb& bounds) {
+    const float c_trav = 1;
+    aabb cb(p[0].c, p[0].c);
+    for (int i = 1; i < n; i++)
+        cb = surrounding_box(cb, aabb(p[i].c, p[i].c));
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_bin = 0;
+    for (int a = 0; a < 3; a++) {
+        float lo = cb.min()[a], ext = cb.max()[a] - lo;
+        if (ext <= 0)
+            continue;
+        int count[BVH_BINS] = {0};
+        aabb bin[BVH_BINS];
+        for (int i = 0; i < n; i++) {
+            int b = std::min(int(BVH_BINS*(p[i].c[a] - lo)/ext), BVH_BINS - 1);
+            bin[b] = count[b]++ ? surrounding_box(bin[b], p[i].box) : p[i].box;
+        }
+        // area and count of the right side of the plane after each bin
+        float right_area[BVH_BINS];
+        int right_count[BVH_BINS];
+        aabb acc;
+        int nacc = 0;
+        for (int b = BVH_BINS - 1; b > 0; b--) {
+            if (count[b])
+                acc = nacc ? surrounding_box(acc, bin[b]) : bin[b];
+            nacc += count[b];
+            right_area[b - 1] = nacc ? surface_area(acc) : 0;
+            right_count[b - 1] = nacc;
+        }
+        nacc = 0;
+        for (int b = 0; b < BVH_BINS - 1; b++) {
+            if (count[b])
+                acc = nacc ? surrounding_box(acc, bin[b]) : bin[b];
+            nacc += count[b];
+            if (!nacc || !right_count[b])
+                continue;
+            float cost = surface_area(acc)*nacc + right_area[b]*right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+    if (best_axis < 0) {
+        // all the centroids at the same place : halve the list if it is too long for a leaf
+        return n > BVH_LEAF ? n/2 : 0;
+    }
+    if (n <= BVH_LEAF && c_trav + best_cost/surface_area(bounds) >= n)
+        return 0;
+    float lo = cb.min()[best_axis], ext = cb.max()[best_axis] - lo;
+    bvh_prim *mid = std::partition(p, p + n, [=](const bvh_prim& q) {
+        return std::min(int(BVH_BINS*(q.c[best_axis] - lo)/ext), BVH_BINS - 1) <= best_bin;
+    });
+    return mid - p;
+}
+
+bvh_node::bvh_node(hittable **l, int n, float time0, float time1, int method) : compiled(0) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (method == BVH_MEDIAN || n < 2) {
+        build_median(l, n, time0, time1);
+    }
+    else {
+        std::vector<bvh_prim> p(n);
+        for (int i = 0; i < n; i++) {
+            p[i].h = l[i];
+            if (!l[i]->bounding_box(time0, time1, p[i].box))
+                std::cerr << "no bounding box in bvh_node constructor\n";
+            p[i].c = 0.5*(p[i].box.min() + p[i].box.max());
+        }
+        aabb bounds = p[0].box;
+        for (int i = 1; i < n; i++)
+            bounds = surrounding_box(bounds, p[i].box);
+        build_sah(&p[0], n, bounds, bvh_sah_split(&p[0], n, bounds), 0);
+    }
+    if (bvh_width == 4)
+        compiled = new bvh_wide<4>(this, time0, time1);
+    else if (bvh_width == 8)
+        compiled = new bvh_wide<8>(this, time0, time1);
+    else if (bvh_flatten)
+        compiled = new bvh_flat(this, time0, time1);
+    bvh_stats.build_time += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// median count split of the objects along the widest axis of their centroids (0 => leaf)
+int bvh_median_split(bvh_prim *p, int n) {
+    if (n <= BVH_LEAF)
+        return 0;
+    aabb cb(p[0].c, p[0].c);
+    for (int i = 1; i < n; i++)
+        cb = surrounding_box(cb, aabb(p[i].c, p[i].c));
+    vec3 ext = cb.max() - cb.min();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (ext[a] > ext[axis])
+            axis = a;
+    std::nth_element(p, p + n/2, p + n, [=](const bvh_prim& a, const bvh_prim& b) {
+        return a.c[axis] < b.c[axis];
+    });
+    return n/2;
+}
+
+// sah subtree over p[0..n-1] at depth : the object itself, a leaf, or a node
+hittable *bvh_node::sah_subtree(bvh_prim *p, int n, int depth) {
+    if (n == 1)
+        return p[0].h;
+    aabb bounds = p[0].box;
+    for (int i = 1; i < n; i++)
+        bounds = surrounding_box(bounds, p[i].box);
+    int m = depth < BVH_SAH_DEPTH ? bvh_sah_split(p, n, bounds) : bvh_median_split(p, n);
+    if (!m) {
+        bvh_stats.leaves++;
+        return new bvh_leaf(p, n, bounds);
+    }
+    bvh_node *node = new bvh_node;
+    node->build_sah(p, n, bounds, m, depth);
+    return node;
+}
+
+// node over p[0..n-1] at depth, split after m objects (0 => all of them in a single leaf child)
+void bvh_node::build_sah(bvh_prim *p, int n, const aabb& bounds, int m, int depth) {
+    bvh_stats.nodes++;
+    box = bounds;
+    if (!m) {
+        bvh_stats.leaves++;
+        left = right = new bvh_leaf(p, n, bounds);
+        return;
+    }
+    left = sah_subtree(p, m, depth + 1);
+    right = sah_subtree(p + m, n - m, depth + 1);
+}
+
+void bvh_node::build_median(hittable **l, int n, float time0, float time1) {
+    bvh_stats.nodes++;
     int axis = int(3*random_double());
 
     if (axis == 0)
@@ -185,8 +715,12 @@ bvh_node::bvh_node(hittable **l, int n, float time0, float time1) {
         right = l[1];
     }
     else {
-        left = new bvh_node(l, n/2, time0, time1);
-        right = new bvh_node(l + n/2, n - n/2, time0, time1);
+        bvh_node *node = new bvh_node;
+        node->build_median(l, n/2, time0, time1);
+        left = node;
+        node = new bvh_node;
+        node->build_median(l + n/2, n - n/2, time0, time1);
+        right = node;
     }
 
     aabb box_left, box_right;
@@ -200,12 +734,13 @@ bvh_node::bvh_node(hittable **l, int n, float time0, float time1) {
     box = surrounding_box(box_left, box_right);
 }
 
-class material  {
+class material : public arena_allocated<material> {
     public:
+        virtual ~material() {}
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, vec3& attenuation,
             ray& scattered) const = 0;
-        virtual vec3 emitted(float u, float v, const vec3& p) const {
+        virtual vec3 emitted(float, float, const vec3&) const {
             return vec3(0,0,0);
         }
 };
@@ -5,8 +5,25 @@
 
 #include "vec3.h"
 
+// per thread generator (xorshift64*) instead of the shared rand() state, so that
+// render threads never touch each other's sequence
+thread_local unsigned long long random_state = 0x9e3779b97f4a7c15ull;
+
+// restarts the calling thread sequence : equal seeds give equal sequences, close seeds
+// unrelated ones (splitmix64 scrambling)
+inline void random_seed(unsigned long long seed) {
+    unsigned long long z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    random_state = z ? z : 0x9e3779b97f4a7c15ull;
+}
+
     inline double random_double() {
-        return rand() / (RAND_MAX + 1.0);
+        random_state ^= random_state >> 12;
+        random_state ^= random_state << 25;
+        random_state ^= random_state >> 27;
+        return ((random_state * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
     }
 vec3 random_in_unit_sphere() {
     vec3 p;
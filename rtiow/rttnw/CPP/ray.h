@@ -6,7 +6,13 @@ class ray
 {
     public:
         ray() {}
-        ray(const vec3& a, const vec3& b, float ti = 0.0) { A = a; B = b; _time = ti;}
+        ray(const vec3& a, const vec3& b, float ti = 0.0) {
+            A = a; B = b; _time = ti;
+            for (int i = 0; i < 3; i++) {
+                inv_B[i] = 1.0f / b[i];
+                sign[i] = inv_B[i] < 0;
+            }
+        }
         vec3 origin() const       { return A; }
         vec3 direction() const    { return B; }
         float time() const { return _time; }
@@ -15,6 +21,8 @@ class ray
         vec3 A;
         vec3 B;
         float _time;
+        vec3 inv_B;     // reciprocal direction and its signs, for the box slab tests
+        int sign[3];
 };
 
 #endif
@@ -1,10 +1,14 @@
 #include <iostream>
 #include <cfloat>
+#include <chrono>
+#include <cstring>
 
 #include "camera.h"
 #include "sphere.h"
 #include "hittable_list.h"
 #include "random.h"
+#include "perlin.h"
+#include "tiles.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -33,8 +37,9 @@ vec3 color(const ray& r, hittable *world, int depth) {
     }
 }
 
-class texture {
+class texture : public arena_allocated<texture> {
     public:
+        virtual ~texture() {}
         virtual vec3 value(float u, float v, const vec3& p) const = 0;
 };
 
@@ -182,9 +187,10 @@ class dielectric : public material {
 
 class image_texture : public texture {
     public:
-        image_texture() {}
+        image_texture() : data(0) {}
         image_texture(unsigned char *pixels, int A, int B)
             : data(pixels), nx(A), ny(B) {}
+        virtual ~image_texture() { stbi_image_free(data); }   // owns the stbi_load() pixels
         virtual vec3 value(float u, float v, const vec3& p) const;
         unsigned char *data;
         int nx, ny;
@@ -205,8 +211,8 @@ vec3 image_texture::value(float u, float v, const vec3& p) const {
 
 hittable *random_scene() {
     int n = 50000;
-    hittable **list = new hittable*[n+1];
-    hittable **slist = new hittable*[n+1];
+    hittable **list = scene_array<hittable*>(n+1);
+    hittable **slist = scene_array<hittable*>(n+1);
     int i = 0;
 #if 1
     texture *checker = new checker_texture(
@@ -295,7 +301,7 @@ hittable *two_spheres() {
         new constant_texture(vec3(0.9, 0.9, 0.9))
     );
     int n = 50;
-    hittable **list = new hittable*[n+1];
+    hittable **list = scene_array<hittable*>(n+1);
 //    list[0] =  new sphere(vec3(0,-1000,0), 1000, new lambertian(checker));
 //    list[0] =  new sphere(vec3(0,-1000,0), 1000, new diffuse_light(new constant_texture(vec3(4,4,4))));
     list[0] =  new sphere(vec3(0,-1000,0), 1000, new diffuse_light(checker));
@@ -304,107 +310,6 @@ hittable *two_spheres() {
     return new hittable_list(list,2);
 }
 
-inline float trilinear_interp(float c[2][2][2], float u, float v, float w) {
-    float accum = 0;
-    for (int i=0; i < 2; i++)
-        for (int j=0; j < 2; j++)
-            for (int k=0; k < 2; k++)
-                accum += (i*u + (1-i)*(1-u))*
-                         (j*v + (1-j)*(1-v))*
-                         (k*w + (1-k)*(1-w))*c[i][j][k];
-
-    return accum;
-}
-
-inline float perlin_interp(vec3 c[2][2][2], float u, float v, float w) {
-    float uu = u*u*(3-2*u);
-    float vv = v*v*(3-2*v);
-    float ww = w*w*(3-2*w);
-    float accum = 0;
-    for (int i=0; i < 2; i++)
-        for (int j=0; j < 2; j++)
-            for (int k=0; k < 2; k++) {
-                vec3 weight_v(u-i, v-j, w-k);
-                accum += (i*uu + (1-i)*(1-uu))*
-                    (j*vv + (1-j)*(1-vv))*
-                    (k*ww + (1-k)*(1-ww))*dot(c[i][j][k], weight_v);
-            }
-    return accum;
-}
-
-class perlin {
-    public:
-        float noise(const vec3& p) const {
-            float u = p.x() - floor(p.x());
-            float v = p.y() - floor(p.y());
-            float w = p.z() - floor(p.z());
-            int i = floor(p.x());
-            int j = floor(p.y());
-            int k = floor(p.z());
-            vec3 c[2][2][2];
-            for (int di=0; di < 2; di++)
-                for (int dj=0; dj < 2; dj++)
-                    for (int dk=0; dk < 2; dk++)
-                        c[di][dj][dk] = ranvec[
-                            perm_x[(i+di) & 255] ^
-                            perm_y[(j+dj) & 255] ^
-                            perm_z[(k+dk) & 255]
-                        ];
-            return perlin_interp(c, u, v, w);
-        }
-        static vec3 *ranvec;
-        static int *perm_x;
-        static int *perm_y;
-        static int *perm_z;
-
-float turb(const vec3& p, int depth=7) const {
-    float accum = 0;
-    vec3 temp_p = p;
-    float weight = 1.0;
-    for (int i = 0; i < depth; i++) {
-        accum += weight*noise(temp_p);
-        weight *= 0.5;
-        temp_p *= 2;
-    }
-    return fabs(accum);
-}
-
-};
-
-static vec3* perlin_generate() {
-    vec3 *p = new vec3[256];
-    for (int i = 0; i < 256; ++i) {
-        double x_random = 2*random_double() - 1;
-        double y_random = 2*random_double() - 1;
-        double z_random = 2*random_double() - 1;
-        p[i] = unit_vector(vec3(x_random, y_random, z_random));
-    }
-    return p;
-}
-
-void permute(int *p, int n) {
-    for (int i = n-1; i > 0; i--) {
-        int target = int(random_double()*(i+1));
-        int tmp = p[i];
-        p[i] = p[target];
-        p[target] = tmp;
-    }
-    return;
-}
-
-static int* perlin_generate_perm() {
-    int * p = new int[256];
-    for (int i = 0; i < 256; i++)
-        p[i] = i;
-    permute(p, 256);
-    return p;
-}
-
-vec3 *perlin::ranvec = perlin_generate();
-int *perlin::perm_x = perlin_generate_perm();
-int *perlin::perm_y = perlin_generate_perm();
-int *perlin::perm_z = perlin_generate_perm();
-
 class noise_texture : public texture {
     public:
         noise_texture() {}
@@ -434,7 +339,7 @@ hittable *two_perlin_spheres() {
         new constant_texture(vec3(0.9, 0.9, 0.9))
     );
 #endif
-    hittable **list = new hittable*[2];
+    hittable **list = scene_array<hittable*>(2);
     list[0] = new sphere(vec3(0,-1000, 0), 1000, new lambertian(pertext));
     list[1] = new sphere(vec3(0, 2, 0), 2, new lambertian(pertext));
     return new hittable_list(list, 2);
@@ -445,7 +350,7 @@ int nx, ny, nn;
 unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
 material *mat = new lambertian(new image_texture(tex_data, nx, ny));
 
-    hittable **list = new hittable*[2];
+    hittable **list = scene_array<hittable*>(2);
     list[1] = new sphere(vec3(0, 2, 0), 2, mat);
     list[0] = new sphere(vec3(0,-1000, 0), 1000, new diffuse_light(new constant_texture(vec3(4,4,4))));
     return new hittable_list(list, 2);
@@ -456,7 +361,7 @@ int nx, ny, nn;
 unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
 material *mat = new lambertian(new image_texture(tex_data, nx, ny));
     texture *pertext = new noise_texture(4);
-    hittable **list = new hittable*[4];
+    hittable **list = scene_array<hittable*>(4);
     int i = 0;
     list[i++] = new sphere(vec3(0,-1000, 0), 1000, new lambertian(pertext));
 //    list[i++] = new sphere(vec3(0, 2, 0), 2, new lambertian(pertext));
@@ -471,7 +376,7 @@ material *mat = new lambertian(new image_texture(tex_data, nx, ny));
 }
 
 hittable *cornell_box() {
-    hittable **list = new hittable*[100];
+    hittable **list = scene_array<hittable*>(100);
     int i = 0;
     material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
     material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
@@ -521,6 +426,7 @@ class constant_medium : public hittable {
     public:
         constant_medium(hittable *b, float d, texture *a) : boundary(b), density(d) {
             phase_function = new isotropic(a);
+            hasbox = boundary->bounding_box(0, 1, bbox);
         }
         virtual bool hit(
             const ray& r, float t_min, float t_max, hit_record& rec) const;
@@ -530,6 +436,8 @@ class constant_medium : public hittable {
         hittable *boundary;
         float density;
         material *phase_function;
+        bool hasbox;
+        aabb bbox;
 };
 
 bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec)
@@ -539,6 +447,10 @@ const {
     const bool enableDebug = false;
     bool debugging = enableDebug && random_double() < 0.00001;
 
+    // the scattering point is inside the boundary, clipped to ]t_min,t_max[
+    if (hasbox && !bbox.hit(r, t_min, t_max))
+        return false;
+
     hit_record rec1, rec2;
 
     if (boundary->hit(r, -FLT_MAX, FLT_MAX, rec1)) {
@@ -582,7 +494,7 @@ const {
 }
 
 hittable *cornell_smoke() {
-    hittable **list = new hittable*[8];
+    hittable **list = scene_array<hittable*>(8);
     int i = 0;
     material *red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
     material *white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
@@ -613,9 +525,9 @@ hittable *cornell_smoke() {
 
 hittable *final() {
     int nb = 20;
-    hittable **list = new hittable*[30];
-    hittable **boxlist = new hittable*[10000];
-    hittable **boxlist2 = new hittable*[10000];
+    hittable **list = scene_array<hittable*>(30);
+    hittable **boxlist = scene_array<hittable*>(10000);
+    hittable **boxlist2 = scene_array<hittable*>(10000);
     material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)));
     material *ground = new lambertian( new constant_texture(vec3(0.48, 0.83, 0.53)));
     int b = 0;
@@ -665,14 +577,13 @@ hittable *final() {
     return new hittable_list(list,l);
 }
 
-int sph_hit = 0;
-int msph_hit = 0;
-
 int main(int argc, char *argv[]) {
-    srand(0);
+    random_seed(0);
     int nx = 200;//200
     int ny = 100;//100
     int ns = 100;//100
+    int nthreads = std::thread::hardware_concurrency();
+    const char *scene = "cornell_box";
     int arg = 1;
     if (arg < argc) {
         sscanf(argv[arg++], "%d", &nx);
@@ -680,92 +591,109 @@ int main(int argc, char *argv[]) {
             sscanf(argv[arg++], "%d", &ny);
             if (arg < argc) {
                 sscanf(argv[arg++], "%d", &ns);
+                if (arg < argc) {
+                    scene = argv[arg++];
+                    if (arg < argc) {
+                        // sah|median, -rec suffix : recursive traversal instead of the flattened bvh,
+                        // -w4/-w8 : 4/8 wide bvh
+                        const char *bvh = argv[arg++];
+                        bvh_method = strncmp(bvh, "median", 6) ? BVH_SAH : BVH_MEDIAN;
+                        bvh_flatten = !strstr(bvh, "-rec");
+                        bvh_width = strstr(bvh, "-w8") ? 8 : strstr(bvh, "-w4") ? 4 : 2;
+                        if (arg < argc)
+                            sscanf(argv[arg++], "%d", &nthreads);
+                    }
+                }
             }
         }
     }
     std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-#if 1
-hittable *world = cornell_box();
-//hittable *world = cornell_smoke();
-//hittable *world = final();
-//hittable *world = cornell_sphere();
-
-vec3 lookfrom(278, 278, -800);
-vec3 lookat(278,278,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-float vfov = 40.0;
-
-camera cam(lookfrom, lookat, vec3(0,1,0), vfov, float(nx)/float(ny),
-    aperture, dist_to_focus, 0.0, 1.0);
-#elif 1
-hittable *world = simple_light();
-
-vec3 lookfrom(6,2,3);
-vec3 lookat(0,2,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-camera cam(lookfrom, lookat, vec3(0,1,0), 50, float(nx)/float(ny),
-           aperture, dist_to_focus, 0.0, 1.0);
-#elif 1
-    hittable *world = random_scene();
-
-vec3 lookfrom(13,2,3);
-vec3 lookat(0,0,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-
-camera cam(
-    lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny), aperture,
-    dist_to_focus, 0.0, 1.0
-);
-#elif 1
-    hittable *world = two_spheres();
-
-vec3 lookfrom(10,1.5,3);
-vec3 lookat(0,0.4,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-
-camera cam(
-    lookfrom, lookat, vec3(0,1,0), 13, float(nx)/float(ny), aperture,
-    dist_to_focus, 0.0, 1.0
-);
-#elif 0
-    hittable *world = two_perlin_spheres();
-
-vec3 lookfrom(13,2,3);
-vec3 lookat(0,0,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny),
-           aperture, dist_to_focus, 0.0, 1.0);
-#else
-    hittable *world = two_tex_spheres();
-
-vec3 lookfrom(13,2,3);
-vec3 lookat(0,0,0);
-float dist_to_focus = 10.0;
-float aperture = 0.0;
-camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny),
-           aperture, dist_to_focus, 0.0, 1.0);
-#endif
-
-    int gsph_hit = 0, gmsph_hit = 0;
-    time_t t0 = time(0);
+    // the scene objects live in the arena, released with it at the end of main(); it is only
+    // current while the scene is built (not while rendering, from several threads)
+    scene_arena arena;
+    current_arena = &arena;
+    std::chrono::steady_clock::time_point tb = std::chrono::steady_clock::now();
+    hittable *world;
+    vec3 lookfrom(13,2,3);
+    vec3 lookat(0,0,0);
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    float vfov = 20.0;
+    if (!strcmp(scene, "cornell_box") || !strcmp(scene, "cornell_smoke") || !strcmp(scene, "final")) {
+        world = !strcmp(scene, "final") ? final() : !strcmp(scene, "cornell_smoke") ? cornell_smoke() : cornell_box();
+        lookfrom = vec3(278, 278, -800);
+        lookat = vec3(278,278,0);
+        vfov = 40.0;
+    }
+    else if (!strcmp(scene, "simple_light")) {
+        world = simple_light();
+        lookfrom = vec3(6,2,3);
+        lookat = vec3(0,2,0);
+        vfov = 50.0;
+    }
+    else if (!strcmp(scene, "random_scene")) {
+        world = random_scene();
+    }
+    else if (!strcmp(scene, "two_spheres")) {
+        world = two_spheres();
+        lookfrom = vec3(10,1.5,3);
+        lookat = vec3(0,0.4,0);
+        vfov = 13.0;
+    }
+    else if (!strcmp(scene, "two_perlin_spheres")) {
+        world = two_perlin_spheres();
+    }
+    else if (!strcmp(scene, "two_tex_spheres")) {
+        world = two_tex_spheres();
+    }
+    else {
+        std::cerr << "unknown scene " << scene << "\n";
+        current_arena = 0;
+        return 1;
+    }
+    current_arena = 0;
+    camera cam(lookfrom, lookat, vec3(0,1,0), vfov, float(nx)/float(ny),
+        aperture, dist_to_focus, 0.0, 1.0);
+    double scene_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - tb).count();
+
+    if (nthreads < 1)
+        nthreads = 1;
+    // each thread accumulates its tiles in its own buffer before copying them into the image;
+    // every pixel restarts the generator from its own index, so that the image does not depend
+    // on which thread renders it, nor on the threads count
+    const int tile_size = 16;
+    std::vector<vec3> image(nx*ny);
+    std::vector<std::vector<vec3> > accum(nthreads, std::vector<vec3>(tile_size*tile_size));
+    std::vector<hit_stats_t> stats(nthreads);
+    tile_scheduler scheduler(nx, ny, tile_size, nthreads);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    scheduler.run([&](int thread, const tile& t) {
+        std::vector<vec3>& buf = accum[thread];
+        hit_stats = hit_stats_t();  // counts of this tile only, added to its thread ones below
+        for (int j = t.y0; j < t.y1; j++) {
+            for (int i = t.x0; i < t.x1; i++) {
+                random_seed((unsigned long long)j*nx + i);
+                vec3& col = buf[(j - t.y0)*tile_size + i - t.x0];
+                col = vec3(0, 0, 0);
+                for (int s=0; s < ns; s++) {
+                    float u = float(i + random_double()) / float(nx);
+                    float v = float(j + random_double()) / float(ny);
+                    ray r = cam.get_ray(u, v);
+                    col += color(r, world,0);
+                }
+            }
+        }
+        for (int j = t.y0; j < t.y1; j++)
+            for (int i = t.x0; i < t.x1; i++)
+                image[j*nx + i] = buf[(j - t.y0)*tile_size + i - t.x0];
+        stats[thread].sph += hit_stats.sph;
+        stats[thread].msph += hit_stats.msph;
+        stats[thread].visits += hit_stats.visits;
+    });
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
     for (int j = ny-1; j >= 0; j--) {
         for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
-            for (int s=0; s < ns; s++) {
-                float u = float(i + random_double()) / float(nx);
-                float v = float(j + random_double()) / float(ny);
-                ray r = cam.get_ray(u, v);
-                sph_hit = 0;
-                msph_hit = 0;
-                col += color(r, world,0);
-                gsph_hit += sph_hit; gmsph_hit += msph_hit;
-//                fprintf(stderr, "sph_hit=%d msph_hit=%d total=%d\n", sph_hit, msph_hit, sph_hit + msph_hit);
-            }
+            vec3 col = image[j*nx + i];
             col /= float(ns);
             col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
             int ir = int(255.99*col[0]);
@@ -778,8 +706,23 @@ camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny),
         }
         std::cout << "\n";
     }
-    time_t t1 = time(0);
-    int ti = t1 - t0;
-    double sp = (double)(gsph_hit + gmsph_hit) / ti;
-    fprintf(stderr, "sph_hit=%d msph_hit=%d total=%d time=%d speed=%.2f hit/sec\n", gsph_hit, gmsph_hit, gsph_hit + gmsph_hit, ti, sp);
+    // sum of the per thread counters, each the sum of the tiles of that thread
+    hit_stats_t total = { 0, 0, 0 };
+    int stolen = 0;
+    for (int k = 0; k < nthreads; k++) {
+        total.sph += stats[k].sph;
+        total.msph += stats[k].msph;
+        total.visits += stats[k].visits;
+        stolen += scheduler.stolen[k];
+    }
+    double ti = std::chrono::duration<double>(t1 - t0).count();
+    double sp = (double)(total.sph + total.msph) / ti;
+    fprintf(stderr, "sph_hit=%llu msph_hit=%llu total=%llu time=%.2f speed=%.2f hit/sec threads=%d stolen=%d\n",
+        total.sph, total.msph, total.sph + total.msph, ti, sp, nthreads, stolen);
+    fprintf(stderr, "bvh=%s%s%s build=%.3f ms nodes=%d leaves=%d visits=%llu visits/ray=%.2f\n",
+        bvh_method == BVH_SAH ? "sah" : "median", bvh_flatten ? "" : "-rec",
+        bvh_width == 8 ? "-w8" : bvh_width == 4 ? "-w4" : "", bvh_stats.build_time*1e3, bvh_stats.nodes, bvh_stats.leaves,
+        total.visits, (double)total.visits/((double)nx*ny*ns));
+    fprintf(stderr, "scene=%s build=%.3f ms objects=%zu arena=%zu KiB in %zu blocks\n",
+        scene, scene_time*1e3, arena.objects(), arena.used() >> 10, arena.nblocks());
 }
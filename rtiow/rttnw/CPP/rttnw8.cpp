@@ -513,9 +513,6 @@ const int N = 10;
     return new hittable_list(list,i);
 }
 
-int sph_hit = 0;
-int msph_hit = 0;
-
 int main(int argc, char *argv[]) {
     srand(0);
     int nx = 200;//200
@@ -605,11 +602,7 @@ camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny),
                 float u = float(i + random_double()) / float(nx);
                 float v = float(j + random_double()) / float(ny);
                 ray r = cam.get_ray(u, v);
-                sph_hit = 0;
-                msph_hit = 0;
                 col += color(r, world,0);
-                gsph_hit += sph_hit; gmsph_hit += msph_hit;
-//                fprintf(stderr, "sph_hit=%d msph_hit=%d total=%d\n", sph_hit, msph_hit, sph_hit + msph_hit);
             }
             col /= float(ns);
             col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
@@ -624,6 +617,7 @@ camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny),
         std::cout << "\n";
     }
     time_t t1 = time(0);
+    gsph_hit = hit_stats.sph; gmsph_hit = hit_stats.msph;
     int ti = t1 - t0;
     double sp = (double)(gsph_hit + gmsph_hit) / ti;
     fprintf(stderr, "sph_hit=%d msph_hit=%d total=%d time=%d speed=%.2f hit/sec\n", gsph_hit, gmsph_hit, gsph_hit + gmsph_hit, ti, sp);
@@ -24,7 +24,7 @@ void get_sphere_uv(const vec3& p, float& u, float& v) {
 }
 
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-sph_hit++;
+hit_stats.sph++;
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -73,7 +73,7 @@ vec3 moving_sphere::center(float time) const{
 }
 
 bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-msph_hit++;
+hit_stats.msph++;
     vec3 oc = r.origin() - center(r.time());
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -100,7 +100,7 @@ msph_hit++;
     return false;
 }
 
-bool sphere::bounding_box(float t0, float t1, aabb& box) const {
+bool sphere::bounding_box(float, float, aabb& box) const {
     box = aabb(center - vec3(radius, radius, radius),
                center + vec3(radius, radius, radius));
     return true;
@@ -119,9 +119,9 @@ class xy_rect: public hittable {
     public:
         xy_rect() {}
         xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat)
-            : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
+            : mp(mat), x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+        virtual bool bounding_box(float, float, aabb& box) const {
             box =  aabb(vec3(x0,y0, k-0.0001), vec3(x1, y1, k+0.0001));
             return true;
         }
@@ -133,9 +133,9 @@ class xz_rect: public hittable {
     public:
         xz_rect() {}
         xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat)
-            : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
+            : mp(mat), x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+        virtual bool bounding_box(float, float, aabb& box) const {
             box =  aabb(vec3(x0,k-0.0001,z0), vec3(x1, k+0.0001, z1));
             return true;
         }
@@ -147,9 +147,9 @@ class yz_rect: public hittable {
     public:
         yz_rect() {}
         yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat)
-            : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
+            : mp(mat), y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+        virtual bool bounding_box(float, float, aabb& box) const {
             box =  aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
             return true;
         }
@@ -235,7 +235,7 @@ class box: public hittable {
         box() {}
         box(const vec3& p0, const vec3& p1, material *ptr);
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+        virtual bool bounding_box(float, float, aabb& box) const {
             box =  aabb(pmin, pmax);
             return true;
         }
@@ -246,7 +246,7 @@ class box: public hittable {
 box::box(const vec3& p0, const vec3& p1, material *ptr) {
     pmin = p0;
     pmax = p1;
-    hittable **list = new hittable*[6];
+    hittable **list = scene_array<hittable*>(6);
     list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
     list[1] = new flip_normals(
         new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
@@ -298,7 +298,7 @@ class rotate_y : public hittable {
         rotate_y(hittable *p, float angle);
         virtual bool hit(
             const ray& r, float t_min, float t_max, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+        virtual bool bounding_box(float, float, aabb& box) const {
             box = bbox; return hasbox;
         }
         hittable *ptr;
@@ -338,6 +338,9 @@ rotate_y::rotate_y(hittable *p, float angle) : ptr(p) {
 }
 
 bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    // the rotated object lies in bbox : no need to rotate the rays missing it
+    if (hasbox && !bbox.hit(r, t_min, t_max))
+        return false;
     vec3 origin = r.origin();
     vec3 direction = r.direction();
     origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
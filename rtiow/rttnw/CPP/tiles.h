@@ -0,0 +1,83 @@
+#ifndef TILESH
+#define TILESH
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// tile of the frame : pixels [x0,x1[ x [y0,y1[
+struct tile {
+    int x0, y0, x1, y1;
+};
+
+// parallel tile scheduler with work stealing : the frame is cut into square tiles, dealt
+// in contiguous runs into one queue per thread; each thread renders its own queue front
+// to back, then steals from the back of the other queues, so that the threads given the
+// expensive part of the frame (around a light) are helped by the ones done early
+class tile_scheduler {
+    public:
+        tile_scheduler(int nx, int ny, int size, int nthreads) : stolen(nthreads), queues(nthreads) {
+            std::vector<tile> tiles;
+            for (int y0 = 0; y0 < ny; y0 += size) {
+                for (int x0 = 0; x0 < nx; x0 += size) {
+                    tile t = { x0, y0, std::min(x0 + size, nx), std::min(y0 + size, ny) };
+                    tiles.push_back(t);
+                }
+            }
+            int n = tiles.size();
+            for (int i = 0; i < nthreads; i++)
+                queues[i].tiles.assign(tiles.begin() + long(n)*i/nthreads, tiles.begin() + long(n)*(i + 1)/nthreads);
+        }
+        // calls render(thread, tile) on every tile from nthreads threads (the caller included),
+        // returns when all of them are done
+        template<class F> void run(F render) {
+            std::vector<std::thread> threads;
+            for (int i = 1; i < int(queues.size()); i++)
+                threads.push_back(std::thread([this, i, &render] { work(i, render); }));
+            work(0, render);
+            for (size_t i = 0; i < threads.size(); i++)
+                threads[i].join();
+        }
+        int threads() const { return queues.size(); }
+        // tiles taken from other queues, per thread
+        std::vector<int> stolen;
+    private:
+        struct queue {
+            std::mutex mutex;
+            std::deque<tile> tiles;
+        };
+        bool pop(int i, tile& t) {
+            std::lock_guard<std::mutex> lock(queues[i].mutex);
+            if (queues[i].tiles.empty())
+                return false;
+            t = queues[i].tiles.front();
+            queues[i].tiles.pop_front();
+            return true;
+        }
+        bool steal(int i, tile& t) {
+            for (int k = 1; k < int(queues.size()); k++) {
+                queue& q = queues[(i + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (!q.tiles.empty()) {
+                    t = q.tiles.back();
+                    q.tiles.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+        template<class F> void work(int i, F& render) {
+            tile t;
+            while (pop(i, t))
+                render(i, t);
+            while (steal(i, t)) {
+                stolen[i]++;
+                render(i, t);
+            }
+        }
+        std::vector<queue> queues;
+};
+
+#endif
@@ -9,28 +9,40 @@
 #include <vector>
 #include <iostream>
 
-#if 0
-template<int n> class vec;
-typedef vec<3> v3;
-template<int n> class vec {
+#if defined __SSE__
+#include <xmmintrin.h>
+#endif
+
+// 3d vector of scalar T, stored on W >= 3 lanes (W = 4 pads to a full SSE register)
+// element-wise operations run on every lane, dot products only on the first 3
+template<class T = double, int W = 3> class vec;
+// scalar of the engines : double, or float with the USE_FLOAT build flag
+#ifdef USE_FLOAT
+typedef float real;
 #else
-class vec;
-typedef vec v3;
-class vec {
-	static const int n = 3;
+typedef double real;
 #endif
+typedef vec<real> v3;
+typedef vec<float> v3f;
+typedef vec<float, 4> v4f;	// packed float layout (SSE register when available)
+
+template<class T, int W> class vec {
+	enum { n = 3 };
 public:
-	vec( double d1 = 0, double d2 = 0, double d3 = 0) {
+	vec( T d1 = 0, T d2 = 0, T d3 = 0) {
 		m_d[0] = d1;
 		m_d[1] = d2;
 		m_d[2] = d3;
+		for (unsigned ii = n; ii < W; ii++) {
+			m_d[ii] = 0;
+		}
 	}
-	vec( const double *d) {
-		for (unsigned ii = 0; ii < n; ii++) {
-			m_d[ii] = *d++;
+	template<class U> vec( const U *d) {
+		for (unsigned ii = 0; ii < W; ii++) {
+			m_d[ii] = ii < n ? *d++ : 0;
 		}
 	}
-	const double& at( unsigned i) const {
+	const T& at( unsigned i) const {
 		assert( (i < n));
 		return m_d[i];
 	}
@@ -41,30 +53,30 @@ public:
 		res.m_d[2] = this->m_d[0] * r.m_d[1] - this->m_d[1] * r.m_d[0];
 		return res;
 	}
-	const vec& operator/=( const double& r) {
-		for (unsigned ii = 0; ii < n; ii++) {
+	const vec& operator/=( const T& r) {
+		for (unsigned ii = 0; ii < W; ii++) {
 			m_d[ii] /= r;
 		}
 		return *this;
 	}
-	vec operator/( const double& r) const {
+	vec operator/( const T& r) const {
 		vec res = *this;
 		res /= r;
 		return res;
 	}
-	const vec& operator*=( const double& r) {
-		for (unsigned ii = 0; ii < n; ii++) {
+	const vec& operator*=( const T& r) {
+		for (unsigned ii = 0; ii < W; ii++) {
 			m_d[ii] *= r;
 		}
 		return *this;
 	}
 	const vec& operator*=( const vec& r) {
-		for (unsigned ii = 0; ii < n; ii++) {
+		for (unsigned ii = 0; ii < W; ii++) {
 			m_d[ii] *= r.m_d[ii];
 		}
 		return *this;
 	}
-	vec operator*( const double& r) const {
+	vec operator*( const T& r) const {
 		vec res = *this;
 		res *= r;
 		return res;
@@ -75,7 +87,7 @@ public:
 		return res;
 	}
 	const vec& operator+=( const vec& r) {
-		for (unsigned ii = 0; ii < n; ii++) {
+		for (unsigned ii = 0; ii < W; ii++) {
 			m_d[ii] += r.m_d[ii];
 		}
 		return *this;
@@ -86,7 +98,7 @@ public:
 		return res;
 	}
 	const vec& operator-=( const vec& r) {
-		for (unsigned ii = 0; ii < n; ii++) {
+		for (unsigned ii = 0; ii < W; ii++) {
 			m_d[ii] -= r.m_d[ii];
 		}
 		return *this;
@@ -96,15 +108,14 @@ public:
 		res -= r;
 		return res;
 	}
-	double operator!() const {
+	T operator!() const {
 		return sqrt( *this % *this);
 	}
-	const double& operator[]( unsigned i) const {
-		assert( (i < n));
+	// unchecked (see at()) : keeps the element loops vectorizable
+	const T& operator[]( unsigned i) const {
 		return m_d[i];
 	}
-	double& operator[]( unsigned i) {
-		assert( (i < n));
+	T& operator[]( unsigned i) {
 		return m_d[i];
 	}
 	vec operator~() const {
@@ -112,8 +123,8 @@ public:
 		res /= !res;
 		return res;
 	}
-	double operator%( const vec& r) const {
-		double result = 0;
+	T operator%( const vec& r) const {
+		T result = 0;
 		for (unsigned ii = 0; ii < n; ii++) {
 			result += m_d[ii] * r.m_d[ii];
 		}
@@ -123,7 +134,7 @@ public:
 		for (unsigned ii = 0; ii < n; ii++) {
 			if (ii > 0)
 				printf( ",");
-			printf( "%f", m_d[ii]);
+			printf( "%f", (double)m_d[ii]);
 		}
 		printf( "\n");
 	}
@@ -152,13 +163,136 @@ public:
 		return out;
 	}
 private:
-	double m_d[n];
+	T m_d[W];
+};
+
+#if defined __SSE__
+// packed float : one SSE register, same results as vec<float> (same operations, same order)
+template<> class vec<float, 4> {
+	enum { n = 3 };
+public:
+	vec( float d1 = 0, float d2 = 0, float d3 = 0) {
+		m_v = _mm_set_ps( 0, d3, d2, d1);
+	}
+	template<class U> vec( const U *d) {
+		m_v = _mm_set_ps( 0, d[2], d[1], d[0]);
+	}
+	const float& at( unsigned i) const {
+		assert( (i < n));
+		return m_d[i];
+	}
+	vec operator^( const vec& r) const {
+		__m128 a1 = _mm_shuffle_ps( m_v, m_v, _MM_SHUFFLE( 3, 0, 2, 1));	// y z x
+		__m128 a2 = _mm_shuffle_ps( m_v, m_v, _MM_SHUFFLE( 3, 1, 0, 2));	// z x y
+		__m128 b1 = _mm_shuffle_ps( r.m_v, r.m_v, _MM_SHUFFLE( 3, 0, 2, 1));
+		__m128 b2 = _mm_shuffle_ps( r.m_v, r.m_v, _MM_SHUFFLE( 3, 1, 0, 2));
+		return vec( _mm_sub_ps( _mm_mul_ps( a1, b2), _mm_mul_ps( a2, b1)));
+	}
+	const vec& operator/=( const float& r) {
+		m_v = _mm_div_ps( m_v, _mm_set1_ps( r));
+		return *this;
+	}
+	vec operator/( const float& r) const {
+		return vec( _mm_div_ps( m_v, _mm_set1_ps( r)));
+	}
+	const vec& operator*=( const float& r) {
+		m_v = _mm_mul_ps( m_v, _mm_set1_ps( r));
+		return *this;
+	}
+	const vec& operator*=( const vec& r) {
+		m_v = _mm_mul_ps( m_v, r.m_v);
+		return *this;
+	}
+	vec operator*( const float& r) const {
+		return vec( _mm_mul_ps( m_v, _mm_set1_ps( r)));
+	}
+	vec operator*( const vec& r) const {
+		return vec( _mm_mul_ps( m_v, r.m_v));
+	}
+	const vec& operator+=( const vec& r) {
+		m_v = _mm_add_ps( m_v, r.m_v);
+		return *this;
+	}
+	vec operator+( const vec& r) const {
+		return vec( _mm_add_ps( m_v, r.m_v));
+	}
+	const vec& operator-=( const vec& r) {
+		m_v = _mm_sub_ps( m_v, r.m_v);
+		return *this;
+	}
+	vec operator-( const vec& r) const {
+		return vec( _mm_sub_ps( m_v, r.m_v));
+	}
+	float operator!() const {
+		return sqrt( *this % *this);
+	}
+	const float& operator[]( unsigned i) const {
+		return m_d[i];
+	}
+	float& operator[]( unsigned i) {
+		return m_d[i];
+	}
+	vec operator~() const {
+		return *this / !*this;
+	}
+	// lane products at once, summed in the scalar order
+	float operator%( const vec& r) const {
+		vec p( _mm_mul_ps( m_v, r.m_v));
+		float result = 0;
+		result += p.m_d[0];
+		result += p.m_d[1];
+		result += p.m_d[2];
+		return result;
+	}
+	void Print() const {
+		printf( "%f,%f,%f\n", (double)m_d[0], (double)m_d[1], (double)m_d[2]);
+	}
+	void Print( std::ostream& out) const {
+		out << m_d[0] << ", " << m_d[1] << ", " << m_d[2];
+	}
+	void Json( std::ostream& out) const {
+		out << "[";
+		Print( out);
+		out << "]";
+	}
+	friend std::ostream& operator<<( std::ostream& out, const vec& v) {
+		out << v[0] << " " << v[1] << " " << v[2];
+		return out;
+	}
+private:
+	explicit vec( __m128 v) : m_v( v) {
+	}
+	union {
+		__m128 m_v;
+		float m_d[4];
+	};
 };
+#endif
+
+// solvetri (vec.h) in any scalar : float engines solve in float
+template<class T> int solvetri( const T a, const T b, const T c, T *t1, T *t2) {
+	int result;
+	T d = b * b - 4 * a * c;
+	if (d > 0) {
+		T sd = sqrt( d);
+		*t1 = (-b - sd) / 2 / a;
+		*t2 = (-b + sd) / 2 / a;
+		result = 2;
+	}
+	else if (d == 0) {
+		*t1 = -b / 2 / a;
+		result = 1;
+	}
+	else {
+		result = 0;
+	}
+	return result;
+}
 
-inline void vprint( const v3 &v) {
-	printf( "%f,%f,%f\n", v[0], v[1], v[2]);
+template<class T, int W> inline void vprint( const vec<T, W> &v) {
+	printf( "%f,%f,%f\n", (double)v[0], (double)v[1], (double)v[2]);
 }
 
-inline void vprint( const char *t, const v3 &v) {
-	printf( "%s={%f,%f,%f}\n", t, v[0], v[1], v[2]);
+template<class T, int W> inline void vprint( const char *t, const vec<T, W> &v) {
+	printf( "%s={%f,%f,%f}\n", t, (double)v[0], (double)v[1], (double)v[2]);
 }